@@ -47,6 +47,7 @@ fi
 image="hdr"
 min_error=0
 max_error=5
+profile="default"
 
 if ! [[ -z $1 ]]; then
   image=$1
@@ -67,22 +68,13 @@ if ! [[ -z $3 ]]; then
   max_error=$3
 fi
 
-# get coder_config
-
-finer_grain=`cat $REPO_ROOT/codec/src/coder_config.h|grep -i true |grep -i CTX_ST_FINER_QUANT`  
-if [[ -z $finer_grain ]]; then
-  finer_grain="cg"
-else
-  finer_grain="fg"
+if ! [[ -z $4 ]]; then
+  profile=$4
 fi
 
+# the coder parameters are given by the profile (see codec/src/coder_config.h)
 default_blk_width=512
-ANS_size=`cat $REPO_ROOT/codec/src/coder_config.h |awk -F ' '  '/LOG2_NUM_ANS_STATES/{print $3}'|head -1 | cut -d "(" -f 2| cut -d ")" -f 1`
-symbol_bs=`cat $REPO_ROOT/codec/src/coder_config.h |awk -F ' '  '/EE_BUFFER_SIZE/{print $3}'  | cut -d "(" -f 2| cut -d ")" -f 1`
-iters=`cat $REPO_ROOT/codec/src/coder_config.h |awk -F ' '  '/EE_MAX_ITERATIONS/{print $3}' |head -1 | cut -d "(" -f 2| cut -d ")" -f 1`
-grad4=`cat $REPO_ROOT/codec/src/coder_config.h|grep -i true |awk -F ' '  '/ADD_GRAD_4/{print "_grad4"}'`
-hlfYcoder=`cat $REPO_ROOT/codec/src/coder_config.h|grep -i true |awk -F ' '  '/HALF_Y_CODER/{print "_hlfYcoder"}'`
-codec_config="ANS${ANS_size}_${finer_grain}_BS${symbol_bs}_BW${default_blk_width}_NI${iters}${grad4}${hlfYcoder}"
+codec_config="${profile}_BW${default_blk_width}"
 
 echo "Codec config: $codec_config"
 
@@ -93,7 +85,7 @@ rx_img="${WORKING_DIR}/rx_img.pgm"
 echo "Input image: $src_img"
 for error in $(seq $min_error $max_error)
  do echo -n "$error : " 
- out_string=$( $CODEC 0 $src_img $encoded $error 1 -1 $default_blk_width)
+ out_string=$( $CODEC 0 $src_img $encoded $error 1 -1 $default_blk_width --profile $profile)
  bpp_encoder_analysis=$(echo "$out_string" | awk -F " " '/E=/{ print $0}')
  enco_bw=$(echo "$out_string" | awk -F " " '/time/{ print  $6   }')
 
@@ -122,3 +114,123 @@ for error in $(seq $min_error $max_error)
   echo -e  "$bpp_encoder_analysis | $file_bpp |Encoder BW: $enco_bw | Decoder BW: $deco_bw |$deco_result "
 
 done
+
+
+# Round trip tests of the codec options: the decoded image must be within the
+# NEAR error of the source, and the options that don't change the output
+# (--threads, --pipelined) must produce the same file as the plain encoder
+echo ""
+echo "Codec options round trip tests"
+
+test_blk_size=64
+ref_encoded="${WORKING_DIR}/ref_encoded.jls_ans"
+crop_img="${WORKING_DIR}/crop_img.pgm"
+const_img="${WORKING_DIR}/const_img.pgm"
+noise_img="${WORKING_DIR}/noise_img.pgm"
+failures=0
+
+Test_Fail(){
+  Print_Err "$@"
+  failures=$((failures+1))
+}
+
+# args: name src_img NEAR "encoder options" ["decoder options"]
+Check_Round_Trip(){
+  local name="$1 (NEAR=$3)"
+  if ! $CODEC 0 $2 $encoded $3 0 $test_blk_size $test_blk_size $4 > /dev/null; then
+    Test_Fail "$name: encoder error"
+    return
+  fi
+  if ! $CODEC 1 $encoded $rx_img $5 > /dev/null; then
+    Test_Fail "$name: decoder error"
+    return
+  fi
+  local peak_error=$($EXE_PEAK_ERROR $2 $rx_img)
+  if [[ $peak_error -gt $3 ]]; then
+    Test_Fail "$name: peak error = $peak_error"
+    return
+  fi
+  Print_Msg "$name: OK"
+}
+
+# args: name src_img NEAR "reference encoder options" "encoder options"
+Check_Same_File(){
+  local name="$1 (NEAR=$3)"
+  if ! $CODEC 0 $2 $ref_encoded $3 0 $test_blk_size $test_blk_size $4 > /dev/null ||
+     ! $CODEC 0 $2 $encoded $3 0 $test_blk_size $test_blk_size $5 > /dev/null; then
+    Test_Fail "$name: encoder error"
+    return
+  fi
+  if ! cmp -s $ref_encoded $encoded; then
+    Test_Fail "$name: files differ"
+    return
+  fi
+  Print_Msg "$name: OK"
+}
+
+# The decoded region is compared with the same crop of the source image
+# args: name src_img NEAR "encoder options"
+Check_Region(){
+  local name="$1 (NEAR=$3)"
+  local rows=$(identify -format "%h" $2)
+  local cols=$(identify -format "%w" $2)
+  local x=$((cols/3)) y=$((rows/3)) w=$((cols/4+1)) h=$((rows/4+1))
+  if ! $CODEC 0 $2 $encoded $3 0 $test_blk_size $test_blk_size $4 > /dev/null; then
+    Test_Fail "$name: encoder error"
+    return
+  fi
+  if ! $CODEC 1 $encoded $rx_img --region $x $y $w $h > /dev/null; then
+    Test_Fail "$name: decoder error"
+    return
+  fi
+  convert $2 -crop ${w}x${h}+${x}+${y} +repage $crop_img
+  local peak_error=$($EXE_PEAK_ERROR $crop_img $rx_img)
+  if [[ $peak_error -gt $3 ]]; then
+    Test_Fail "$name: peak error = $peak_error"
+    return
+  fi
+  Print_Msg "$name: OK"
+}
+
+# blocks of these images are coded as constant and stored blocks
+convert -size 256x256 xc:gray50 -depth 8 $const_img
+convert -size 256x256 xc:gray50 +noise Random -colorspace Gray -depth 8 $noise_img
+
+test_errors="$min_error"
+if [[ $max_error -ne $min_error ]]; then
+  test_errors="$test_errors $max_error"
+fi
+
+for error in $test_errors
+do
+  Check_Round_Trip "blocks" $src_img $error "--profile $profile"
+  Check_Round_Trip "multithreaded decoder" $src_img $error "--profile $profile" "--threads 4"
+  Check_Round_Trip "no block index" $src_img $error "--profile $profile --no-index"
+  Check_Round_Trip "no block index, multithreaded decoder" $src_img $error "--profile $profile --no-index" "--threads 4"
+  Check_Round_Trip "strips" $src_img $error "--profile $profile --strips"
+  Check_Round_Trip "two-pass tables" $src_img $error "--profile $profile --two-pass"
+  Check_Round_Trip "static model" $src_img $error "--profile $profile --static-model"
+  Check_Round_Trip "small chunks" $src_img $error "--profile $profile --chunk-size 32"
+  for ans_states in 2 4
+  do
+    Check_Round_Trip "$ans_states ANS states" $src_img $error "--profile $profile --ans-states $ans_states"
+  done
+  for test_profile in default fast dense
+  do
+    Check_Round_Trip "$test_profile profile" $src_img $error "--profile $test_profile"
+  done
+  Check_Round_Trip "constant blocks" $const_img $error "--profile $profile"
+  Check_Round_Trip "stored blocks" $noise_img $error "--profile $profile"
+  Check_Region "region" $src_img $error "--profile $profile"
+  Check_Region "region, strips" $src_img $error "--profile $profile --strips"
+  Check_Region "region, no block index" $src_img $error "--profile $profile --no-index"
+  Check_Same_File "multithreaded encoder" $src_img $error "--profile $profile" "--profile $profile --threads 4"
+  Check_Same_File "pipelined encoder" $src_img $error "--profile $profile" "--profile $profile --pipelined"
+  Check_Same_File "pipelined encoder, 4 ANS states" $src_img $error "--profile $profile --ans-states 4" "--profile $profile --ans-states 4 --pipelined"
+done
+
+if [[ $failures -ne 0 ]]; then
+  Print_Err "$failures option tests failed"
+  exit 3
+fi
+Print_Msg "All option tests passed"
@@ -25,11 +25,16 @@
 #include "codec_core.h"
 #include "context.h"
 #include "img_proc_utils.h"
+#include "ANS_table_gen.h"
 
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstdlib>
+
+namespace CODER_PROFILE_NS {
 
 // #define EE_BUFFER_SIZE (2048)
-#define STACK_SIZE (EE_BUFFER_SIZE* int(MAX_SUPPORTED_BPP/8))
-#define STACK_PTR_INIT (STACK_SIZE-1)
 #define CTX_NT_HALF_IDX (1<<(CTX_NT_PRECISION-1))
 #define CTX_NT_QUANT_BINS (1<<(CTX_NT_PRECISION))
 // #define NUM_ANS_THETA_MODES 32//16 // supported theta_modes
@@ -38,6 +43,10 @@
 
 #define ANS_I_RANGE_START NUM_ANS_STATES
 
+// Interleaved tANS: symbols in a chunk are assigned in round robin to 
+// num_ANS_states (1,2 or 4) independent tANS states, sharing the bit stack
+#define MAX_INTERLEAVED_ANS_STATES (4)
+
 #define ANS_NEXT_STATE 0
 #define ANS_NUM_OF_BITS 1
 const int tANS_STATE_SIZE = std::log2(NUM_ANS_STATES) ; 
@@ -60,15 +69,390 @@ const int tANS_STATE_MASK = (0xFFFF >> (16-tANS_STATE_SIZE));
 #endif 
 // typedef uint8_t binary_stack_t;
 
+// holds a tANS state, including the I range ([0,2*NUM_ANS_STATES))
+#if LOG2_NUM_ANS_STATES < 8
+  typedef uint8_t tANS_state_t;
+#else
+  typedef uint16_t tANS_state_t;
+#endif
+
 struct tANS_ROM_element_t {
-  // int16_t next_state;
-  // int16_t bits;
-  int8_t next_state;
+  tANS_state_t next_state;
   int8_t bits;
 } ;
 typedef tANS_ROM_element_t tANS_table_t;
 
+/* tANS tables:
+ * The tables are compiled in: the ones in ANS_tables (generated with the
+ * coder_config_gen notebook) for the default profile, and the ones in
+ * ANS_TABLES_FILE (ANS_tables/<profile>, written by tools/ans_table_gen) for
+ * the other profiles. Coded files depend on the exact tables, so they are
+ * never built by the codec at startup.
+ * With ANS_TABLES_GENERATED (for experiments only), they are built at startup
+ * from the coder_config.h parameters (see ANS_table_gen.h), together with the
+ * z cardinalities, so LOG2_NUM_ANS_STATES can be changed (ex: 8, 9) without
+ * regenerating anything. The generator uses floating point functions, so
+ * files are only compatible between builds with the same tables.
+ * Decoder tables: [0] symbol, [1] previous state
+ */
+#ifndef ANS_TABLES_GENERATED
+  #define ANS_TABLES_GENERATED (false)
+#endif
+
+#define ANS_SYMBOL 0
+#define ANS_PREV_STATE 1
+
+struct tANS_ROM_tables_t {
+  tANS_table_t z_enc[NUM_ANS_THETA_MODES][NUM_ANS_STATES][ANS_MAX_SRC_CARDINALITY];
+  tANS_table_t y_enc[NUM_ANS_P_MODES][NUM_ANS_STATES][2];
+  tANS_state_t z_dec[NUM_ANS_THETA_MODES][NUM_ANS_STATES][2];
+  tANS_state_t y_dec[NUM_ANS_P_MODES][NUM_ANS_STATES][2];
+  uint8_t z_cardinality[NUM_ANS_THETA_MODES];
+  uint32_t z_max_module[NUM_ANS_THETA_MODES];
+};
+
+template<int MAX_SYMBOLS>
+static void store_tANS_ROM_tables(const std::vector<double> &probs,
+      tANS_table_t enc[NUM_ANS_STATES][MAX_SYMBOLS], tANS_state_t dec[NUM_ANS_STATES][2]){
+  const tANS_gen_tables_t gen = build_tANS_tables(probs,LOG2_NUM_ANS_STATES);
+  assert(gen.num_of_symbols <= MAX_SYMBOLS);
+  for(int state = 0; state < NUM_ANS_STATES; ++state) {
+    for(int symbol = 0; symbol < MAX_SYMBOLS; ++symbol) {
+      enc[state][symbol] = {0,-1};
+      if(symbol < gen.num_of_symbols) {
+        const tANS_gen_enc_entry_t &entry = gen.enc[state*gen.num_of_symbols + symbol];
+        enc[state][symbol] = {tANS_state_t(entry.next_state),int8_t(entry.bits)};
+      }
+    }
+    dec[state][ANS_SYMBOL] = gen.dec[state].symbol;
+    dec[state][ANS_PREV_STATE] = gen.dec[state].prev_state;
+  }
+}
+
+#if ANS_TABLES_GENERATED
+static void build_tANS_ROM_tables(tANS_ROM_tables_t &tables){
+  for(int p_id = 0; p_id < NUM_ANS_P_MODES; ++p_id) {
+    store_tANS_ROM_tables<2>(get_y_source(get_p_mode_param(p_id)),
+                                        tables.y_enc[p_id],tables.y_dec[p_id]);
+  }
+
+  // as in the notebook, the max number of z symbols is the max cardinality
+  // reached with ANS_MAX_SRC_CARDINALITY-1 geometric symbols
+  auto get_theta_z_source = [](int theta_id, int max_symbols){
+    const double St = get_St_mode_param(theta_id,CTX_ST_FINER_QUANT);
+    return get_z_source(St/(St+1),LOG2_NUM_ANS_STATES,max_symbols);
+  };
+  int max_z_symbols = 0;
+  for(int theta_id = 0; theta_id < NUM_ANS_THETA_MODES; ++theta_id) {
+    max_z_symbols = std::max(max_z_symbols,
+                    int(get_theta_z_source(theta_id,ANS_MAX_SRC_CARDINALITY-1).size()));
+  }
+  for(int theta_id = 0; theta_id < NUM_ANS_THETA_MODES; ++theta_id) {
+    const std::vector<double> probs = get_theta_z_source(theta_id,max_z_symbols);
+    store_tANS_ROM_tables<ANS_MAX_SRC_CARDINALITY>(probs,
+                                    tables.z_enc[theta_id],tables.z_dec[theta_id]);
+    tables.z_cardinality[theta_id] = probs.size()-1; // + continue symbol
+    tables.z_max_module[theta_id] = tables.z_cardinality[theta_id]*EE_MAX_ITERATIONS;
+  }
+}
+#else
+#ifdef ANS_TABLES_FILE
+  #include ANS_TABLES_FILE // tables of the coder profile
+#else
+static const tANS_table_t tANS_z_encode_table[NUM_ANS_THETA_MODES][NUM_ANS_STATES][ANS_MAX_SRC_CARDINALITY]{
+  #include "ANS_tables/tANS_z_encoder_table.dat"
+};
+static const tANS_table_t tANS_y_encode_table[NUM_ANS_P_MODES][NUM_ANS_STATES][2]{
+  #include "ANS_tables/tANS_y_encoder_table.dat"
+};
+static const tANS_state_t tANS_z_decode_table[NUM_ANS_THETA_MODES][NUM_ANS_STATES][2]{
+  #include "ANS_tables/tANS_z_decoder_table.dat"
+};
+static const tANS_state_t tANS_y_decode_table[NUM_ANS_P_MODES][NUM_ANS_STATES][2]{
+  #include "ANS_tables/tANS_y_decoder_table.dat"
+};
+static const uint8_t (&tANS_z_cardinality)[NUM_ANS_THETA_MODES] = tANS_cardinality_table;
+#endif
+
+static void build_tANS_ROM_tables(tANS_ROM_tables_t &tables){
+  memcpy(tables.z_enc,tANS_z_encode_table,sizeof(tables.z_enc));
+  memcpy(tables.y_enc,tANS_y_encode_table,sizeof(tables.y_enc));
+  memcpy(tables.z_dec,tANS_z_decode_table,sizeof(tables.z_dec));
+  memcpy(tables.y_dec,tANS_y_decode_table,sizeof(tables.y_dec));
+  for(int theta_id = 0; theta_id < NUM_ANS_THETA_MODES; ++theta_id) {
+    tables.z_cardinality[theta_id] = tANS_z_cardinality[theta_id];
+    tables.z_max_module[theta_id] = tables.z_cardinality[theta_id]*EE_MAX_ITERATIONS;
+  }
+}
+#endif
+
+/* Packed z encoder table:
+ * The ROM z encoder table has ANS_MAX_SRC_CARDINALITY columns for every mode,
+ * but a mode only uses cardinality+1 (remainder symbols and the continue
+ * symbol). The packed table, built at startup, stores only the used columns
+ * of each mode, starting at offset[mode], so the entries touched by the coder
+ * fit in fewer cache lines. The entries are allocated once their number is
+ * known (the cardinalities are built at startup with ANS_TABLES_GENERATED),
+ * 64-byte aligned. The whole table still exceeds a typical L1 (44 KB with the
+ * default tables); only the modes of the coded contexts are hot. Entries are in state-major order (the symbols of
+ * a state are contiguous). With Z_ENC_TABLE_SYMBOL_MAJOR, all the states of a
+ * symbol are contiguous instead (the continue symbol of a mode is a single
+ * range).
+ */
+#ifndef Z_ENC_TABLE_SYMBOL_MAJOR
+  #define Z_ENC_TABLE_SYMBOL_MAJOR (false)
+#endif
+
+struct tANS_z_enc_packed_table_t {
+  tANS_table_t* entry; // size entries, released with the table set
+  uint32_t offset[NUM_ANS_THETA_MODES]; // first entry of the mode
+  uint32_t size; // number of used entries
+};
+
+static inline uint z_enc_entry_idx(uint state, uint symbol, uint cardinality){
+  #if Z_ENC_TABLE_SYMBOL_MAJOR
+    return symbol*NUM_ANS_STATES + state;
+  #else
+    return state*(cardinality+1) + symbol;
+  #endif
+}
+
+static void build_tANS_z_enc_packed_table(const tANS_ROM_tables_t &rom,
+                                            tANS_z_enc_packed_table_t &table){
+  uint offset = 0;
+  for(int mode = 0; mode < NUM_ANS_THETA_MODES; ++mode) {
+    assert(rom.z_cardinality[mode] < ANS_MAX_SRC_CARDINALITY);
+    table.offset[mode] = offset;
+    // modes start at a cache line if NUM_ANS_STATES*sizeof(tANS_table_t) is a
+    // multiple of 64 bytes (32 or more states). Not required for correctness
+    offset += NUM_ANS_STATES*(rom.z_cardinality[mode]+1);
+  }
+  table.size = offset;
+
+  // aligned_alloc requires a multiple of the alignment
+  const size_t bytes = (table.size*sizeof(tANS_table_t) + 63) & ~size_t(63);
+  table.entry = (tANS_table_t*)aligned_alloc(64,bytes);
+  if(table.entry == nullptr) {
+    std::cerr<<DBG_INFO<<"Error: Can't allocate the tANS tables"<<std::endl;
+    throw 1;
+  }
+
+  for(int mode = 0; mode < NUM_ANS_THETA_MODES; ++mode) {
+    const uint cardinality = rom.z_cardinality[mode];
+    for(uint state = 0; state < NUM_ANS_STATES; ++state) {
+      for(uint symbol = 0; symbol <= cardinality; ++symbol) {
+        table.entry[table.offset[mode] + z_enc_entry_idx(state,symbol,cardinality)] =
+                                                    rom.z_enc[mode][state][symbol];
+      }
+    }
+  }
+}
+
+/* z run tables:
+ * z is coded as a number of "continue" symbols (symbol = cardinality)
+ * followed by the remainder symbol. On noisy content (high theta_id) runs are
+ * long, and each continue symbol is a dependent tANS step. These tables,
+ * derived from the z tables at startup, code several continue symbols in a
+ * single step. They don't change the bitstream.
+ * Encoder: the number of continue symbols is known, so there's an entry for
+ * runs of 2 and 4 symbols for every state (bits of each step concatenated).
+ * Longer runs are split (ex: 7 = 4+2+1)
+ * In modes where runs are rare, the run steps are slower than coding the
+ * continue symbols one by one, so both coders only use the run tables in the
+ * modes where the continue symbol has probability >= 3/4 (z_mode_has_runs)
+ */
+#if SYMBOL_ENDIANNESS_LITTLE && ARCH == 64 && 4*LOG2_NUM_ANS_STATES <= 32
+  #define Z_RUN_ENCODER (true)
+#else
+  #define Z_RUN_ENCODER (false) // bits of a run don't fit in the bit buffer
+#endif
+#define Z_RUN_ENC_LENGTHS (2) // runs of 2 and 4 symbols
+
+struct tANS_z_run_enc_element_t {
+  uint32_t bits; // bits of the steps, in push order
+  uint8_t num_of_bits;
+  tANS_state_t next_state;
+};
+
+struct tANS_z_run_enc_table_t {
+  tANS_z_run_enc_element_t run[NUM_ANS_THETA_MODES][NUM_ANS_STATES][Z_RUN_ENC_LENGTHS];
+  bool mode_has_runs[NUM_ANS_THETA_MODES]; // see z_mode_has_runs
+};
+
+// true if the continue symbol has probability >= 3/4 (its share of the
+// decoder states), so runs of 2 or more symbols have probability >= 9/16
+static bool z_mode_has_runs(const tANS_ROM_tables_t &rom, int mode){
+  int continue_states = 0;
+  for(int state_idx = 0; state_idx < NUM_ANS_STATES; ++state_idx) {
+    continue_states += rom.z_dec[mode][state_idx][ANS_SYMBOL] == rom.z_cardinality[mode];
+  }
+  return 4*continue_states >= 3*NUM_ANS_STATES;
+}
+
+static void build_tANS_z_run_enc_table(const tANS_ROM_tables_t &rom,
+                                            tANS_z_run_enc_table_t &table){
+  for(int mode = 0; mode < NUM_ANS_THETA_MODES; ++mode) {
+    const int continue_symb = rom.z_cardinality[mode];
+    table.mode_has_runs[mode] = z_mode_has_runs(rom,mode);
+    for(int state = 0; state < NUM_ANS_STATES; ++state) {
+      for(int len_idx = 0; len_idx < Z_RUN_ENC_LENGTHS; ++len_idx) {
+        uint32_t bits = 0;
+        uint num_of_bits = 0, run_state = state;
+        for(int i = 0; i < 2<<len_idx; ++i) {
+          const tANS_table_t &step = rom.z_enc[mode][run_state][continue_symb];
+          bits = (bits << step.bits) | (run_state & ((1<<step.bits)-1));
+          num_of_bits += step.bits;
+          run_state = step.next_state;
+        }
+        table.run[mode][state][len_idx] = {bits,uint8_t(num_of_bits),tANS_state_t(run_state)};
+      }
+    }
+  }
+}
+
+/* z run decoder table (see z run tables):
+ * The bits a continue symbol requires depend on the previous steps, so only
+ * runs of continue symbols that don't require reading bits (the common case
+ * at high theta_id) are decoded in a single step. For each state, the table
+ * has the length of that run (upto EE_MAX_ITERATIONS) and the state after it
+ */
+struct tANS_z_run_dec_element_t {
+  uint8_t length;
+  tANS_state_t state;
+};
+
+struct tANS_z_run_dec_table_t {
+  tANS_z_run_dec_element_t run[NUM_ANS_THETA_MODES][NUM_ANS_STATES];
+  bool mode_has_runs[NUM_ANS_THETA_MODES]; // false: not used (see z_mode_has_runs)
+};
 
+static void build_tANS_z_run_dec_table(const tANS_ROM_tables_t &rom,
+                                            tANS_z_run_dec_table_t &table){
+  for(int mode = 0; mode < NUM_ANS_THETA_MODES; ++mode) {
+    const int continue_symb = rom.z_cardinality[mode];
+    const bool use_runs = z_mode_has_runs(rom,mode);
+    table.mode_has_runs[mode] = false;
+    for(int state_idx = 0; state_idx < NUM_ANS_STATES; ++state_idx) {
+      uint length = 0, state = ANS_I_RANGE_START + state_idx;
+      while(length < EE_MAX_ITERATIONS) {
+        const tANS_state_t* step = rom.z_dec[mode][state & tANS_STATE_MASK];
+        if(step[ANS_SYMBOL] != continue_symb || step[ANS_PREV_STATE] < ANS_I_RANGE_START) {
+          break;
+        }
+        state = step[ANS_PREV_STATE];
+        length++;
+      }
+      table.run[mode][state_idx] = {uint8_t(length),tANS_state_t(state)};
+      table.mode_has_runs[mode] |= length != 0 && use_runs;
+    }
+  }
+}
+
+/* Decoder tables with the renormalization:
+ * The new state is state_base | (next num_of_bits bits), where state_base is
+ * the previous state shifted to the I range. Derived at startup from the
+ * decoder tables
+ */
+struct tANS_dec_element_t {
+  uint8_t symbol;
+  uint8_t num_of_bits;
+  tANS_state_t state_base;
+};
+
+template<int NUM_MODES>
+struct tANS_dec_table_t {
+  tANS_dec_element_t entry[NUM_MODES][NUM_ANS_STATES];
+};
+
+template<int NUM_MODES>
+static void build_tANS_dec_table(const tANS_state_t dec_table[NUM_MODES][NUM_ANS_STATES][2],
+                                              tANS_dec_table_t<NUM_MODES> &table){
+  for(int mode = 0; mode < NUM_MODES; ++mode) {
+    for(int state_idx = 0; state_idx < NUM_ANS_STATES; ++state_idx) {
+      uint state = dec_table[mode][state_idx][ANS_PREV_STATE];
+      assert(state != 0);
+      uint num_of_bits = 0;
+      while(state < ANS_I_RANGE_START) {
+        state <<= 1;
+        num_of_bits++;
+      }
+      table.entry[mode][state_idx] = {uint8_t(dec_table[mode][state_idx][ANS_SYMBOL]),
+                                    uint8_t(num_of_bits),tANS_state_t(state)};
+    }
+  }
+}
+
+/* tANS table set:
+ * The ROM tables and the tables the coders derive from them. The coders use
+ * the default set unless they are given another one, like the per-image set
+ * of the two-pass mode (see build_image_tANS_tables). Outside of the profile
+ * namespace, sets are handled as the base struct (see codec_core.h)
+ */
+struct tANS_coder_tables_t : public ::tANS_coder_tables_t {
+  tANS_ROM_tables_t rom;
+  tANS_z_enc_packed_table_t z_enc_packed;
+  tANS_z_run_enc_table_t z_run_enc;
+  tANS_z_run_dec_table_t z_run_dec;
+  tANS_dec_table_t<NUM_ANS_THETA_MODES> z_dec;
+  tANS_dec_table_t<NUM_ANS_P_MODES> y_dec;
+};
+
+// tables.rom has to be set
+static void build_tANS_derived_tables(tANS_coder_tables_t &tables){
+  build_tANS_z_enc_packed_table(tables.rom,tables.z_enc_packed);
+  build_tANS_z_run_enc_table(tables.rom,tables.z_run_enc);
+  build_tANS_z_run_dec_table(tables.rom,tables.z_run_dec);
+  build_tANS_dec_table<NUM_ANS_THETA_MODES>(tables.rom.z_dec,tables.z_dec);
+  build_tANS_dec_table<NUM_ANS_P_MODES>(tables.rom.y_dec,tables.y_dec);
+}
+
+// The set can be released before its tables are built (ex: invalid table section)
+static tANS_coder_tables_t* alloc_tANS_coder_tables(){
+  tANS_coder_tables_t* tables = (tANS_coder_tables_t*)malloc(sizeof(tANS_coder_tables_t));
+  if(tables == nullptr) {
+    std::cerr<<DBG_INFO<<"Error: Can't allocate the tANS tables"<<std::endl;
+    throw 1;
+  }
+  tables->z_enc_packed.entry = nullptr;
+  return tables;
+}
+
+static void free_tANS_coder_tables(const tANS_coder_tables_t* tables){
+  if(tables != nullptr) {
+    free(tables->z_enc_packed.entry);
+  }
+  free((void*)tables);
+}
+
+// built on first use and never released
+static const tANS_coder_tables_t* get_default_tANS_tables(){
+  static const tANS_coder_tables_t* const default_tables = [](){
+    tANS_coder_tables_t* tables = alloc_tANS_coder_tables();
+    build_tANS_ROM_tables(tables->rom);
+    build_tANS_derived_tables(*tables);
+    return tables;
+  }();
+  return default_tables;
+}
+
+// Maps the symbol y mode to the y coder modes (see HALF_Y_CODER). Returns 
+// false if y is stored as a raw bit
+static inline bool map_y_coder_mode(ee_symb_data &symbol){
+  #if !HALF_Y_CODER
+    if(unlikely(symbol.p_id >= CTX_NT_HALF_IDX)) {
+      #if CTX_NT_CENTERED_QUANT
+        if(symbol.p_id == CTX_NT_HALF_IDX) {
+          return false;
+        }
+        symbol.p_id = CTX_NT_QUANT_BINS - symbol.p_id;
+      #else
+        symbol.p_id = CTX_NT_QUANT_BINS-1 - symbol.p_id;
+      #endif
+      symbol.y = symbol.y == 0?1:0;
+    }
+  #endif
+  return true;
+}
 
 
 class Symbol_Coder
@@ -88,37 +472,57 @@ class Symbol_Coder
 
   private:
     uint symbols_in_buffer ;
-    // std::vector<ee_symb_data> entropy_encoder_buffer;
-    std::array<ee_symb_data,EE_BUFFER_SIZE> entropy_encoder_buffer;
+    uint ee_buffer_size; // symbols per chunk
+    std::vector<ee_symb_data> entropy_encoder_buffer;
 
     // ANS
     uint ANS_encoder_state ; // = ANS_I_RANGE_START & tANS_STATE_MASK
     size_t geometric_coder_iters;
 
+    // interleaved ANS states (ANS_encoder_state is the one in use)
+    uint num_ANS_states;
+    uint ANS_state_idx; // index of the state in ANS_encoder_state
+    uint ANS_encoder_states[MAX_INTERLEAVED_ANS_STATES];
+
     // binary writer 
     uint8_t* out_file;
     long file_size;
 
-    int stack_ptr ;
-    binary_stack_t encoded_bit_stack[STACK_SIZE];
+    // binary stack: the bits of a chunk are written backwards into out_file,
+    // from stack_end (chunk size upper bound) down to stack_ptr
+    uint8_t* stack_end;
+    uint8_t* stack_ptr; // last word written
     bit_buffer_t bit_buffer;
     uint bit_ptr ;
     // const uint BIT_BUFFER_SIZE = 8*sizeof(binary_stack_t);
 
     int EE_REMAINDER_SIZE;
-    
+
+    const tANS_coder_tables_t* tables;
     
   public:
   // if using the default constructor, set_out_bitfile needs to be called before 
   // coding
-  Symbol_Coder():symbols_in_buffer(0),ANS_encoder_state(0),geometric_coder_iters(0)
-            ,file_size(0) , stack_ptr(STACK_PTR_INIT),bit_buffer(0),bit_ptr(0),EE_REMAINDER_SIZE(7){
-    // entropy_encoder_buffer.reserve(EE_BUFFER_SIZE);
+  Symbol_Coder():symbols_in_buffer(0),ee_buffer_size(EE_BUFFER_SIZE)
+            ,entropy_encoder_buffer(EE_BUFFER_SIZE),ANS_encoder_state(0),geometric_coder_iters(0)
+            ,num_ANS_states(1),ANS_state_idx(0),ANS_encoder_states{0}
+            ,file_size(0) , stack_end(nullptr),stack_ptr(nullptr),bit_buffer(0),bit_ptr(0),EE_REMAINDER_SIZE(7)
+            ,tables(get_default_tANS_tables()){
   }
 
-  Symbol_Coder(uint8_t *_out_file,int _EE_REMAINDER_SIZE):symbols_in_buffer(0),ANS_encoder_state(0),geometric_coder_iters(0)
-            ,out_file(_out_file),file_size(0) , stack_ptr(STACK_PTR_INIT),bit_buffer(0),bit_ptr(0),EE_REMAINDER_SIZE(_EE_REMAINDER_SIZE){
-    // entropy_encoder_buffer.reserve(EE_BUFFER_SIZE);
+  // _tables: nullptr uses the default tables
+  // _ee_buffer_size: symbols per chunk (it has to match the decoder's)
+  Symbol_Coder(uint8_t *_out_file,int _EE_REMAINDER_SIZE, uint _num_ANS_states=1,
+                                          const tANS_coder_tables_t* _tables=nullptr,
+                                          uint _ee_buffer_size=EE_BUFFER_SIZE):
+            symbols_in_buffer(0),ee_buffer_size(_ee_buffer_size)
+            ,entropy_encoder_buffer(_ee_buffer_size),ANS_encoder_state(0),geometric_coder_iters(0)
+            ,num_ANS_states(_num_ANS_states),ANS_state_idx(0),ANS_encoder_states{0}
+            ,out_file(_out_file),file_size(0) , stack_end(nullptr),stack_ptr(nullptr),bit_buffer(0),bit_ptr(0),EE_REMAINDER_SIZE(_EE_REMAINDER_SIZE)
+            ,tables(_tables != nullptr? _tables : get_default_tANS_tables()){
+    assert(ee_buffer_size > 0);
+    assert(num_ANS_states <= MAX_INTERLEAVED_ANS_STATES);
+    assert((num_ANS_states & (num_ANS_states-1)) == 0);
 
    // TODO: support mac iterations as argument
     //get max iterations and compute the max_module_per_cardinality_table
@@ -131,7 +535,7 @@ class Symbol_Coder
       std::cerr<<"    Call code_symbol_buffer() before quiting." <<std::endl;
     }
 
-    if(stack_ptr != STACK_PTR_INIT) {
+    if(stack_ptr != stack_end || bit_ptr != 0) {
       std::cerr<<"Error: Ending codification with bits in binary stack." <<std::endl;
       std::cerr<<"    Call code_symbol_buffer() before quiting." <<std::endl;
     }
@@ -159,7 +563,7 @@ class Symbol_Coder
       write_byte_in_binary((pixel)&0xFF);
       write_byte_in_binary((pixel>>8)&0xFF);
     }
-    if(unlikely(symbols_in_buffer >= EE_BUFFER_SIZE)) {
+    if(unlikely(symbols_in_buffer >= ee_buffer_size)) {
       std::cerr<<"Warning: Coder symbol buffer is full after storing pixel value" <<std::endl;
     }
   }
@@ -170,67 +574,63 @@ class Symbol_Coder
     // entropy_encoder_buffer.push_back(symbol);
     symbols_in_buffer ++;
 
-    if(unlikely(symbols_in_buffer >= EE_BUFFER_SIZE)) {
+    if(unlikely(symbols_in_buffer >= ee_buffer_size)) {
       code_symbol_buffer();
     }
 
   }
 
   void code_symbol_buffer(){
-    // if(likely( symbols_in_buffer != 0)) { 
-    while(symbols_in_buffer){
-      symbols_in_buffer--;
-    // while(!entropy_encoder_buffer.empty()){
-      ee_symb_data symb_data = entropy_encoder_buffer[symbols_in_buffer];
-      // ee_symb_data symb_data = entropy_encoder_buffer.back();
-      // entropy_encoder_buffer.pop_back();
-      Bernoulli_coder(symb_data);// encode y
-      geometric_coder(symb_data); // encode z 
+    code_symbol_chunk(entropy_encoder_buffer.data(),symbols_in_buffer);
+    symbols_in_buffer = 0;
+  }
+
+  // Encodes a chunk of symbols (in reverse order) and closes it, storing the 
+  // ANS state. Chunks are independent, so they can be generated elsewhere
+  // (see Pipelined_Symbol_Coder)
+  void code_symbol_chunk(const ee_symb_data* symbols, uint num_of_symbols){
+    open_binary_stack(num_of_symbols);
+    if(num_ANS_states == 1) {
+      while(num_of_symbols){
+        num_of_symbols--;
+        ee_symb_data symb_data = symbols[num_of_symbols];
+        Bernoulli_coder(symb_data);// encode y
+        geometric_coder(symb_data); // encode z 
+      }
+    }else{
+      const uint ANS_state_mask = num_ANS_states-1;
+      while(num_of_symbols){
+        num_of_symbols--;
+        select_ANS_state(num_of_symbols & ANS_state_mask);
+        ee_symb_data symb_data = symbols[num_of_symbols];
+        Bernoulli_coder(symb_data);// encode y
+        geometric_coder(symb_data); // encode z 
+      }
+      select_ANS_state(0);
     }
 
     tANS_store_state();
     store_binary_stack(); //go to next byte
-    // symbols_in_buffer = 0;
-
-    // }
-
   }
 
 private:
   void Bernoulli_coder(ee_symb_data symbol){
 
-    static const tANS_table_t tANS_y_encode_table[NUM_ANS_P_MODES][NUM_ANS_STATES][2]{
-      #include "ANS_tables/tANS_y_encoder_table.dat"
-    }; // [0] number of bits, [1] next state
-
-    #if !HALF_Y_CODER
-      if(unlikely(symbol.p_id >= CTX_NT_HALF_IDX)) {
-        #if CTX_NT_CENTERED_QUANT
-          if(symbol.p_id == CTX_NT_HALF_IDX) {
-            push_single_bit_to_binary_stack( symbol.y);
-            return;
-          }
-          symbol.p_id = CTX_NT_QUANT_BINS - symbol.p_id;
-        #else
-          symbol.p_id = CTX_NT_QUANT_BINS-1 - symbol.p_id;
-        #endif
-        symbol.y = symbol.y == 0?1:0;
-      }
-    #endif
+    if(unlikely(!map_y_coder_mode(symbol))) {
+      push_single_bit_to_binary_stack( symbol.y);
+      return;
+    }
     
-    auto current_y_ANS_table = tANS_y_encode_table[symbol.p_id];
+    auto current_y_ANS_table = tables->rom.y_enc[symbol.p_id];
     tANS_encode_bernulli(current_y_ANS_table, symbol.y);
   }
 
   void geometric_coder(ee_symb_data symbol){
-      static const tANS_table_t tANS_encode_table[NUM_ANS_THETA_MODES][NUM_ANS_STATES][ANS_MAX_SRC_CARDINALITY]{
-      #include "ANS_tables/tANS_z_encoder_table.dat"
-    }; 
-
-    const auto max_allowed_module = max_module_per_cardinality_table[symbol.theta_id ];
-    const auto encoder_cardinality = tANS_cardinality_table[symbol.theta_id ];
+    const auto max_allowed_module = tables->rom.z_max_module[symbol.theta_id ];
+    const auto encoder_cardinality = tables->rom.z_cardinality[symbol.theta_id ];
     int module_reminder = symbol.z;
-    auto current_ANS_table = tANS_encode_table[symbol.theta_id];
+    const tANS_table_t* current_ANS_table = tables->z_enc_packed.entry + 
+                                    tables->z_enc_packed.offset[symbol.theta_id];
 
     assert(encoder_cardinality>0);
     int ans_symb = module_reminder & (encoder_cardinality-1);
@@ -246,9 +646,29 @@ private:
       ans_symb = encoder_cardinality;
     }
 
+    #if Z_RUN_ENCODER
+    if(tables->z_run_enc.mode_has_runs[symbol.theta_id]) {
+      module_reminder -= ans_symb;
+      tANS_encode(current_ANS_table, encoder_cardinality, ans_symb);
+
+      // continue symbols (cardinalities are powers of 2)
+      int run_length = module_reminder >> __builtin_ctz(encoder_cardinality);
+      module_reminder -= run_length * encoder_cardinality;
+      if(run_length & 1) {
+        tANS_encode(current_ANS_table, encoder_cardinality, encoder_cardinality);
+      }
+      for(int len_idx = 0; len_idx < Z_RUN_ENC_LENGTHS; ++len_idx) {
+        if(run_length & (2<<len_idx)) {
+          tANS_encode_run(tables->z_run_enc.run[symbol.theta_id],len_idx);
+        }
+      }
+      assert(module_reminder==0);
+      return;
+    }
+    #endif
     do {
       module_reminder -= ans_symb;
-      tANS_encode(current_ANS_table, ans_symb);
+      tANS_encode(current_ANS_table, encoder_cardinality, ans_symb);
       ans_symb = encoder_cardinality;
 
     }while(module_reminder > 0);
@@ -262,7 +682,20 @@ private:
   // ---------------------------------------------
 
 
+  void inline select_ANS_state(uint idx){
+    ANS_encoder_states[ANS_state_idx] = ANS_encoder_state;
+    ANS_encoder_state = ANS_encoder_states[idx];
+    ANS_state_idx = idx;
+  }
+
+  // Stores the ANS states. The state in use (state 0) is stored last, so 
+  // the decoder reads it first, right after the bit marker
   void inline tANS_store_state(){
+    assert(ANS_state_idx == 0);
+    for(uint idx = num_ANS_states-1; idx > 0; --idx) {
+      push_bits_to_binary_stack(ANS_encoder_states[idx] ,tANS_STATE_SIZE);
+      ANS_encoder_states[idx] = 0; // = ANS_I_RANGE_START & tANS_STATE_MASK
+    }
 
     #if tANS_STATE_SIZE+1 > 8
     #error The bit buffer stores upto 8 bits. binary stack should use a type with more bits, but just changing the type causes endianness problems and/or others
@@ -289,12 +722,15 @@ private:
   }
 
 
-  void inline tANS_encode(const tANS_table_t tANS_encode_table[NUM_ANS_STATES][ANS_MAX_SRC_CARDINALITY], uint symbol){
+  // tANS_encode_table: mode table of tANS_z_enc_packed_table
+  void inline tANS_encode(const tANS_table_t* tANS_encode_table, uint cardinality, uint symbol){
     #ifdef ANALYSIS_CODE
       geometric_coder_iters++; // analysis
     #endif
 
-    const int num_of_bits = tANS_encode_table[ANS_encoder_state][symbol].bits;
+    const tANS_table_t &entry = tANS_encode_table[
+                                z_enc_entry_idx(ANS_encoder_state,symbol,cardinality)];
+    const int num_of_bits = entry.bits;
 
     assert(num_of_bits >= 0);
     // if(num_of_bits) {
@@ -302,10 +738,22 @@ private:
     // uint BIT_MASK = 0xFF >> (8-num_of_bits);
     push_bits_to_binary_stack( ANS_encoder_state & BIT_MASK,num_of_bits);
     // }
-    ANS_encoder_state = tANS_encode_table[ANS_encoder_state][symbol].next_state;
+    ANS_encoder_state = entry.next_state;
 
   }
 
+  // encodes a run of 2<<len_idx continue symbols
+  void inline tANS_encode_run(const tANS_z_run_enc_element_t run_table[NUM_ANS_STATES][Z_RUN_ENC_LENGTHS], 
+                                                                      uint len_idx){
+    #ifdef ANALYSIS_CODE
+      geometric_coder_iters += 2<<len_idx; // analysis
+    #endif
+
+    const tANS_z_run_enc_element_t &run = run_table[ANS_encoder_state][len_idx];
+    push_bits_to_binary_stack(run.bits,run.num_of_bits);
+    ANS_encoder_state = run.next_state;
+  }
+
 
   // ---------------------------------------------
   // --------------- Binary Writer --------------- 
@@ -328,19 +776,9 @@ private:
       #if BIT_ENDIANNESS_LITTLE && !SYMBOL_ENDIANNESS_LITTLE
         aux = __builtin_bitreverse8(aux);
       #endif
-      encoded_bit_stack[stack_ptr] =  aux;
-      // encoded_bit_stack[stack_ptr] =  binary_stack_t(bit_buffer);
-      // encoded_bit_stack[stack_ptr] =  uint8_t(bit_buffer &0xFF);
+      push_word_to_binary_stack(aux);
       bit_ptr = 0;
       bit_buffer =  0;
-      // stack_ptr-=sizeof(binary_stack_t);
-      stack_ptr--;
-
-      if(unlikely(stack_ptr < 0)) {
-        std::cerr<<DBG_INFO<<"ERROR: Stack overflow. MAX_SUPPORTED_BPP ("<<MAX_SUPPORTED_BPP<<
-              ") it's not enough. Can't fix this, quiting"<<std::endl;
-        throw 1;
-      }
     }
   }
 
@@ -373,21 +811,31 @@ private:
       bit_buffer >>=BIT_BUFFER_SIZE;
       #endif
 
-      encoded_bit_stack[stack_ptr] =  aux;
-      // encoded_bit_stack[stack_ptr] =  binary_stack_t(bit_buffer);
-
-      // stack_ptr-=sizeof(binary_stack_t);
-      stack_ptr--;
-
-      if(unlikely(stack_ptr < 0)) {
-        std::cerr<<DBG_INFO<<"ERROR: Stack overflow. MAX_SUPPORTED_BPP ("<<MAX_SUPPORTED_BPP<<
-              ") it's not enough. Can't fix this, quiting"<<std::endl;
-        throw 1;
-      }
+      push_word_to_binary_stack(aux);
     }
 
   } 
 
+  // Chunk size upper bound: MAX_SUPPORTED_BPP per symbol, plus the ANS states
+  static size_t get_max_chunk_size(uint num_of_symbols){
+    return size_t(num_of_symbols)*(MAX_SUPPORTED_BPP/8) + ENCODER_OUTPUT_PADDING;
+  }
+
+  void open_binary_stack(uint num_of_symbols){
+    stack_end = out_file + file_size + get_max_chunk_size(num_of_symbols);
+    stack_ptr = stack_end;
+  }
+
+  void inline push_word_to_binary_stack(binary_stack_t word){
+    stack_ptr -= sizeof(binary_stack_t);
+    if(unlikely(stack_ptr < out_file + file_size)) {
+      std::cerr<<DBG_INFO<<"ERROR: Stack overflow. MAX_SUPPORTED_BPP ("<<MAX_SUPPORTED_BPP<<
+            ") it's not enough. Can't fix this, quiting"<<std::endl;
+      throw 1;
+    }
+    memcpy(stack_ptr,&word,sizeof(binary_stack_t));
+  }
+
   void  write_byte_in_binary(uint32_t byte  ){
     out_file[file_size] = byte;
     file_size++;
@@ -406,38 +854,379 @@ private:
           aux = __builtin_bitreverse8(aux);
         #endif
       #endif
-      encoded_bit_stack[stack_ptr] =  aux;
-      // encoded_bit_stack[stack_ptr] =  binary_stack_t(bit_buffer);
-      extra_bytes = 4-((bit_ptr+7)>>3);
-      // stack_ptr--; 
-      // extra_bytes = 0;
+      push_word_to_binary_stack(aux);
+      extra_bytes = sizeof(binary_stack_t)-((bit_ptr+7)>>3);
       assert(extra_bytes <= sizeof(binary_stack_t));
       bit_buffer = 0;
       bit_ptr = 0;
-
-      // BUILD_BUG_ON(sizeof(binary_stack_t) > 1);
-      //   Currently sizeof(binary_stack_t) > 1 is not supported
-      //   need to check how many bytes are added here 
-      //   Also, endianness should be taken into account
-    }else{
-      stack_ptr++; 
     }
-    const int bytes_in_stack = (STACK_PTR_INIT - stack_ptr +1)*sizeof(binary_stack_t)
-                              - extra_bytes;
-    uint8_t * first_byte = (uint8_t *)(encoded_bit_stack+stack_ptr) + extra_bytes;
-    // const int bytes_in_stack = (STACK_PTR_INIT - stack_ptr +1)*sizeof(binary_stack_t)
-    //                           + 0;
-    // auto first_byte = encoded_bit_stack+stack_ptr;
-    memcpy(out_file+file_size,first_byte,bytes_in_stack);
-    // memcpy(out_file+file_size,encoded_bit_stack + stack_ptr,bytes_in_stack);
+    // the chunk is already in out_file, it only needs to be moved down to 
+    // file_size (the gap left by the upper bound)
+    const uint8_t * first_byte = stack_ptr + extra_bytes;
+    const size_t bytes_in_stack = stack_end - first_byte;
+    if(first_byte != out_file+file_size) {
+      memmove(out_file+file_size,first_byte,bytes_in_stack);
+    }
 
     file_size += bytes_in_stack;
-    stack_ptr = STACK_PTR_INIT;
+    stack_end = stack_ptr = nullptr;
+  }
+
+
+};
+
+
+/* Pipelined_Symbol_Coder has the same interface as Symbol_Coder, but the 
+ * tANS coding and bit packing is done by a second thread. 
+ * The context modeling thread (producer) fills the symbol chunks of a 
+ * single-producer single-consumer lock-free ring. When a chunk is full 
+ * (ee_buffer_size symbols), it's handed to the coder thread, which encodes 
+ * it using code_symbol_chunk(). 
+ * Chunk boundaries are the same as in Symbol_Coder, so the output is the same.
+ */
+#define PIPELINE_RING_CHUNKS (4)
+class Pipelined_Symbol_Coder
+{
+  struct symbol_chunk_t {
+    uint num_of_symbols;
+    bool last_chunk;
+    ee_symb_data* symbols; // ee_buffer_size symbols
+  };
+
+  Symbol_Coder symbol_coder; // only used by coder_thread after construction
+  symbol_chunk_t* ring;
+  std::vector<ee_symb_data> ring_symbols; // symbols of all the ring chunks
+  uint ee_buffer_size;
+
+  // ring indexes (chunk idx = idx % PIPELINE_RING_CHUNKS)
+  alignas(64) std::atomic<uint> produced_chunks;
+  alignas(64) std::atomic<uint> coded_chunks;
+  std::atomic<bool> coder_error;
+
+  symbol_chunk_t* current_chunk; // chunk being filled by the producer
+  std::thread coder_thread;
+
+public:
+  Pipelined_Symbol_Coder(uint8_t *_out_file,int _EE_REMAINDER_SIZE, uint _num_ANS_states=1,
+                                          const tANS_coder_tables_t* _tables=nullptr,
+                                          uint _ee_buffer_size=EE_BUFFER_SIZE):
+      symbol_coder(_out_file,_EE_REMAINDER_SIZE,_num_ANS_states,_tables,_ee_buffer_size),
+      ring_symbols(PIPELINE_RING_CHUNKS*_ee_buffer_size),ee_buffer_size(_ee_buffer_size),
+      produced_chunks(0),coded_chunks(0),coder_error(false){
+    ring = new symbol_chunk_t[PIPELINE_RING_CHUNKS];
+    for(int chunk = 0; chunk < PIPELINE_RING_CHUNKS; ++chunk) {
+      ring[chunk].symbols = ring_symbols.data() + chunk*ee_buffer_size;
+    }
+    current_chunk = ring;
+    current_chunk->num_of_symbols = 0;
+    coder_thread = std::thread(&Pipelined_Symbol_Coder::coder_loop,this);
+  }
+
+  ~Pipelined_Symbol_Coder(){
+    if(coder_thread.joinable()) {
+      std::cerr<<"Error: Ending codification with symbols in the buffer." <<std::endl;
+      std::cerr<<"    Call code_symbol_buffer() before quiting." <<std::endl;
+      publish_chunk(true);
+      coder_thread.join();
+    }
+    delete[] ring;
+  }
+
+  size_t get_out_file_size() const {
+    return symbol_coder.get_out_file_size();
+  }
+
+  size_t get_geometric_coder_iters() const {
+    return symbol_coder.get_geometric_coder_iters();
   }
 
+  // It has to be called before pushing any symbol
+  void store_pixel(unsigned int pixel, int bits){
+    assert(produced_chunks == 0 && current_chunk->num_of_symbols == 0);
+    // the coder thread does not access out_file until it gets the first chunk
+    symbol_coder.store_pixel(pixel,bits);
+  }
+
+  void push_symbol(ee_symb_data symbol ){
+    current_chunk->symbols[current_chunk->num_of_symbols] = symbol;
+    current_chunk->num_of_symbols++;
+
+    if(unlikely(current_chunk->num_of_symbols >= ee_buffer_size)) {
+      publish_chunk(false);
+    }
+  }
+
+  // hands the last chunk to the coder thread and waits until it's done
+  void code_symbol_buffer(){
+    publish_chunk(true);
+    coder_thread.join();
+    if(coder_error) {
+      std::cerr<<DBG_INFO<<"ERROR: Pipelined coder thread failed"<<std::endl;
+      throw 1;
+    }
+  }
+
+private:
+  void publish_chunk(bool last_chunk){
+    const uint next_chunk = produced_chunks.load(std::memory_order_relaxed)+1;
+    current_chunk->last_chunk = last_chunk;
+    produced_chunks.store(next_chunk,std::memory_order_release);
+    if(last_chunk) {
+      return;
+    }
+
+    // wait for a free chunk 
+    while(unlikely(next_chunk - coded_chunks.load(std::memory_order_acquire) 
+                                                  >= PIPELINE_RING_CHUNKS)) {
+      std::this_thread::yield();
+    }
+    current_chunk = &ring[next_chunk % PIPELINE_RING_CHUNKS];
+    current_chunk->num_of_symbols = 0;
+  }
+
+  void coder_loop(){
+    uint chunk_idx = 0;
+    while(true){
+      // wait for a chunk
+      while(chunk_idx == produced_chunks.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      const symbol_chunk_t &chunk = ring[chunk_idx % PIPELINE_RING_CHUNKS];
+      const bool last_chunk = chunk.last_chunk;
+
+      if(likely(!coder_error)) {
+        try{
+          symbol_coder.code_symbol_chunk(chunk.symbols,chunk.num_of_symbols);
+        }catch(...){
+          coder_error = true; // reported by code_symbol_buffer()
+        }
+      }
+      chunk_idx++;
+      coded_chunks.store(chunk_idx,std::memory_order_release);
+
+      if(last_chunk) {
+        return;
+      }
+    }
+  }
+};
+
+
+/* Per-image tANS tables (two-pass mode):
+ * A first pass over the image, with Symbol_Counter as the symbol coder, gets
+ * the histogram of the tANS symbols of every mode. Then, the modes whose
+ * estimated coded size is reduced by more than the cost of storing them get
+ * new tables, built from slot counts fitted to the histogram. Cardinalities
+ * are not changed, so the tables are a drop-in replacement of the default ones.
+ * The file stores the slot counts, from which the decoder builds the same
+ * tables (build_tANS_tables is deterministic). Table section format:
+ *   uint8_t number of z modes. For each one, uint8_t theta_id and the slot
+ *     counts-1 of the cardinality remainder symbols (the continue symbol gets
+ *     the remaining slots)
+ *   uint8_t number of y modes. For each one, uint8_t p_id and the slot
+ *     count-1 of y == 0
+ * Slot counts are stored in sizeof(tANS_state_t) bytes, little endian.
+ */
+#define IMAGE_TABLES_MIN_GAIN (32) // bits saved by a mode, besides its cost
+
+struct tANS_symbol_stats_t {
+  uint64_t z[NUM_ANS_THETA_MODES][ANS_MAX_SRC_CARDINALITY];
+  uint64_t y[NUM_ANS_P_MODES][2];
+};
+
+// Same interface as Symbol_Coder. It counts the tANS symbols the coder
+// would use for each symbol
+class Symbol_Counter
+{
+  tANS_symbol_stats_t &stats;
+  const tANS_ROM_tables_t &rom;
+
+public:
+  Symbol_Counter(tANS_symbol_stats_t &_stats):
+      stats(_stats),rom(get_default_tANS_tables()->rom){
+    memset(&stats,0,sizeof(stats));
+  }
+
+  size_t get_out_file_size() const {return 0;}
+  size_t get_geometric_coder_iters() const {return 0;}
+  void store_pixel(unsigned int pixel, int bits){}
+  void code_symbol_buffer(){}
+
+  void push_symbol(ee_symb_data symbol){
+    if(map_y_coder_mode(symbol)) {
+      stats.y[symbol.p_id][symbol.y]++;
+    }
 
+    const uint cardinality = rom.z_cardinality[symbol.theta_id];
+    if(unlikely(symbol.z >= rom.z_max_module[symbol.theta_id])) {
+      stats.z[symbol.theta_id][cardinality] += EE_MAX_ITERATIONS; // escape
+    }else{
+      stats.z[symbol.theta_id][symbol.z & (cardinality-1)]++;
+      stats.z[symbol.theta_id][cardinality] += symbol.z / cardinality;
+    }
+  }
 };
 
+// Slot counts (at least 1) that minimize the estimated coded size of hist.
+// Slots are assigned one by one to the symbol with the largest size reduction
+static void fit_tANS_slot_counts(const uint64_t* hist, int num_of_symbols, int* slots){
+  for(int s = 0; s < num_of_symbols; ++s) {
+    slots[s] = 1;
+  }
+  for(int slot = num_of_symbols; slot < NUM_ANS_STATES; ++slot) {
+    int best_symbol = 0;
+    double best_gain = -1;
+    for(int s = 0; s < num_of_symbols; ++s) {
+      const double gain = hist[s]*std::log2((slots[s]+1)/double(slots[s]));
+      if(gain > best_gain) {
+        best_gain = gain;
+        best_symbol = s;
+      }
+    }
+    slots[best_symbol]++;
+  }
+}
+
+// a symbol with F slots takes about log2(NUM_ANS_STATES/F) bits
+static double get_tANS_coded_size(const uint64_t* hist, int num_of_symbols, const int* slots){
+  double bits = 0;
+  for(int s = 0; s < num_of_symbols; ++s) {
+    bits += hist[s]*std::log2(NUM_ANS_STATES/double(slots[s]));
+  }
+  return bits;
+}
+
+static void get_tANS_slot_counts(const tANS_state_t dec[NUM_ANS_STATES][2],
+                                            int num_of_symbols, int* slots){
+  std::fill(slots,slots+num_of_symbols,0);
+  for(int state = 0; state < NUM_ANS_STATES; ++state) {
+    slots[dec[state][ANS_SYMBOL]]++;
+  }
+}
+
+template<int MAX_SYMBOLS>
+static void store_tANS_fitted_tables(const int* slots, int num_of_symbols,
+      tANS_table_t enc[NUM_ANS_STATES][MAX_SYMBOLS], tANS_state_t dec[NUM_ANS_STATES][2]){
+  std::vector<double> probs(num_of_symbols);
+  for(int s = 0; s < num_of_symbols; ++s) {
+    probs[s] = slots[s]/double(NUM_ANS_STATES); // exact
+  }
+  store_tANS_ROM_tables<MAX_SYMBOLS>(probs,enc,dec);
+}
+
+// Checks if the mode is worth tuning, appending it to the section if so
+static bool add_image_tANS_mode(const uint64_t* hist, int num_of_symbols,
+        const tANS_state_t dec[NUM_ANS_STATES][2], int mode, std::vector<uint8_t> &section){
+  int slots[ANS_MAX_SRC_CARDINALITY], default_slots[ANS_MAX_SRC_CARDINALITY];
+  fit_tANS_slot_counts(hist,num_of_symbols,slots);
+  get_tANS_slot_counts(dec,num_of_symbols,default_slots);
+  const double mode_cost = 8*(1 + (num_of_symbols-1)*sizeof(tANS_state_t));
+  const double gain = get_tANS_coded_size(hist,num_of_symbols,default_slots) -
+                              get_tANS_coded_size(hist,num_of_symbols,slots);
+  if(gain <= mode_cost + IMAGE_TABLES_MIN_GAIN) {
+    return false;
+  }
+
+  section.push_back(mode);
+  for(int s = 0; s < num_of_symbols-1; ++s) {
+    for(uint byte = 0; byte < sizeof(tANS_state_t); ++byte) {
+      section.push_back(((slots[s]-1) >> (8*byte)) & 0xFF);
+    }
+  }
+  return true;
+}
+
+static void invalid_tANS_table_section(){
+  std::cerr<<"Error: Invalid tANS table section"<<std::endl;
+  throw 1;
+}
+
+static uint8_t read_table_section_byte(const uint8_t* &data, const uint8_t* end){
+  if(data >= end) {
+    invalid_tANS_table_section();
+  }
+  return *data++;
+}
+
+// Reads the slot counts of a mode. The last symbol gets the remaining slots
+static void read_image_tANS_mode(const uint8_t* &data, const uint8_t* end,
+                                            int num_of_symbols, int* slots){
+  int remaining_slots = NUM_ANS_STATES;
+  for(int s = 0; s < num_of_symbols-1; ++s) {
+    slots[s] = 1;
+    for(uint byte = 0; byte < sizeof(tANS_state_t); ++byte) {
+      slots[s] += read_table_section_byte(data,end) << (8*byte);
+    }
+    remaining_slots -= slots[s];
+  }
+  if(remaining_slots < 1) {
+    invalid_tANS_table_section();
+  }
+  slots[num_of_symbols-1] = remaining_slots;
+}
+
+// Builds the table set described by the table section (see Per-image tANS tables)
+static tANS_coder_tables_t* read_image_tANS_tables(const uint8_t* section, size_t size){
+  std::unique_ptr<tANS_coder_tables_t,void(*)(const tANS_coder_tables_t*)> tables(
+                            alloc_tANS_coder_tables(),free_tANS_coder_tables);
+  tANS_ROM_tables_t &rom = tables->rom;
+  rom = get_default_tANS_tables()->rom;
+
+  const uint8_t* data = section;
+  const uint8_t* const end = section + size;
+  int slots[ANS_MAX_SRC_CARDINALITY];
+  const int num_z_modes = read_table_section_byte(data,end);
+  for(int i = 0; i < num_z_modes; ++i) {
+    const int theta_id = read_table_section_byte(data,end);
+    if(theta_id >= NUM_ANS_THETA_MODES) {
+      invalid_tANS_table_section();
+    }
+    const int num_of_symbols = rom.z_cardinality[theta_id]+1;
+    read_image_tANS_mode(data,end,num_of_symbols,slots);
+    store_tANS_fitted_tables<ANS_MAX_SRC_CARDINALITY>(slots,num_of_symbols,
+                                          rom.z_enc[theta_id],rom.z_dec[theta_id]);
+  }
+  const int num_y_modes = read_table_section_byte(data,end);
+  for(int i = 0; i < num_y_modes; ++i) {
+    const int p_id = read_table_section_byte(data,end);
+    if(p_id >= NUM_ANS_P_MODES) {
+      invalid_tANS_table_section();
+    }
+    read_image_tANS_mode(data,end,2,slots);
+    store_tANS_fitted_tables<2>(slots,2,rom.y_enc[p_id],rom.y_dec[p_id]);
+  }
+  if(data != end) {
+    invalid_tANS_table_section();
+  }
+
+  build_tANS_derived_tables(*tables);
+  return tables.release();
+}
+
+// Selects the modes to tune and stores them in section. Returns the new table
+// set, or nullptr if no mode is worth tuning (section is left empty)
+static tANS_coder_tables_t* build_image_tANS_tables(const tANS_symbol_stats_t &stats,
+                                                  std::vector<uint8_t> &section){
+  const tANS_ROM_tables_t &rom = get_default_tANS_tables()->rom;
+  section.assign(1,0);
+  for(int theta_id = 0; theta_id < NUM_ANS_THETA_MODES; ++theta_id) {
+    section[0] += add_image_tANS_mode(stats.z[theta_id],rom.z_cardinality[theta_id]+1,
+                                              rom.z_dec[theta_id],theta_id,section);
+  }
+  const size_t y_modes_pos = section.size();
+  section.push_back(0);
+  for(int p_id = 0; p_id < NUM_ANS_P_MODES; ++p_id) {
+    section[y_modes_pos] += add_image_tANS_mode(stats.y[p_id],2,rom.y_dec[p_id],
+                                                                    p_id,section);
+  }
+
+  if(section[0] == 0 && section[y_modes_pos] == 0) {
+    section.clear();
+    return nullptr;
+  }
+  return read_image_tANS_tables(section.data(),section.size());
+}
+
 
 /***********************
  *Decoder side functions  
@@ -460,42 +1249,68 @@ check_update_block();
 */
 
 
-  #define ANS_SYMBOL 0
-  #define ANS_PREV_STATE 1
+
 class Binary_Decoder
 {
 
   uint remaining_symbols; // remaining symbols excluding those in the current block
   uint blk_rem_symbols;  // remaining symbols in current decoding block
 
+#if SYMBOL_ENDIANNESS_LITTLE
+  // Bits are read with an unaligned 64-bit load from the byte holding the 
+  // next bit, so there's no refill branch. The binary needs 
+  // DECODER_INPUT_PADDING readable bytes after its end.
+  // Bits are stored LSB first in little endian words, which is the same as
+  // LSB first bytes in little endian hosts
+  const uint8_t * block_binary;
+  size_t bit_pos; // number of bits already read from block_binary
+#else
   binary_stack_t * block_binary;
   size_t binary_file_ptr;
   bit_buffer_t binary_buffer;
   int bit_ptr; // number of bits already read from the binary_buffer
   static constexpr int BINARY_BLOCK_BYTES =  sizeof(*block_binary);
   static constexpr int BINARY_BLOCK_BITS =  BINARY_BLOCK_BYTES*8;
-  #if BIT_ENDIANNESS_LITTLE || SYMBOL_ENDIANNESS_LITTLE
+  #if BIT_ENDIANNESS_LITTLE
     static constexpr int bit_ptr_init = 0;
   #else
     static constexpr int bit_ptr_init = BINARY_BLOCK_BYTES*8-1;
   // #define bit_ptr_init (7)
   #endif
+#endif
 
 
 
 public:
-  Binary_Decoder(void* _block_binary,uint total_symbs):
-      block_binary(decltype(block_binary)( _block_binary)),
-      #if BIT_ENDIANNESS_LITTLE ||SYMBOL_ENDIANNESS_LITTLE
-      binary_file_ptr(2), // 2 cause binary_buffer is initialized with the first 2 elements
+  // _tables: nullptr uses the default tables
+  // _ee_buffer_size: symbols per chunk (from the file header)
+  Binary_Decoder(void* _block_binary,uint total_symbs, uint _num_ANS_states=1,
+                                      const tANS_coder_tables_t* _tables=nullptr,
+                                      uint _ee_buffer_size=EE_BUFFER_SIZE):
+      #if SYMBOL_ENDIANNESS_LITTLE
+      block_binary((const uint8_t*)_block_binary),bit_pos(0),
       #else
-      binary_file_ptr(0),
-      #endif 
-      bit_ptr(bit_ptr_init),is_ANS_ready(false),ANS_decoder_state(0){
-    // TODO should be using the buffer size stated in the global header, not EE_BUFFER_SIZE
-    blk_rem_symbols = total_symbs < EE_BUFFER_SIZE? total_symbs : EE_BUFFER_SIZE +1;
+      block_binary(decltype(block_binary)( _block_binary)),
+        #if BIT_ENDIANNESS_LITTLE
+        binary_file_ptr(2), // 2 cause binary_buffer is initialized with the first 2 elements
+        #else
+        binary_file_ptr(0),
+        #endif 
+      bit_ptr(bit_ptr_init),
+      #endif
+      is_ANS_ready(false),ANS_decoder_state(0),
+      num_ANS_states(_num_ANS_states),ANS_state_idx(0),ANS_decoder_states{0},
+      tables(_tables != nullptr? _tables : get_default_tANS_tables()),
+      ee_buffer_size(_ee_buffer_size){
+    assert(num_ANS_states <= MAX_INTERLEAVED_ANS_STATES);
+    assert((num_ANS_states & (num_ANS_states-1)) == 0);
+    assert(ee_buffer_size > 0);
+    // +1: the first pixel is stored raw, before the first chunk
+    blk_rem_symbols = total_symbs <= ee_buffer_size? total_symbs : ee_buffer_size +1;
     remaining_symbols = total_symbs - blk_rem_symbols;
+    #if !SYMBOL_ENDIANNESS_LITTLE
     binary_buffer = decltype(binary_buffer)(block_binary[1])<<BINARY_BLOCK_BITS | block_binary[0];
+    #endif
   }
 
   ~Binary_Decoder(){};
@@ -517,33 +1332,10 @@ public:
   }
 
   #if SYMBOL_ENDIANNESS_LITTLE
-  /* int retrive_bits(int num_of_bits ){
-    int bit_buffer = 0;
-    for(int i = 0; i < num_of_bits; ++i) {
-      // bit_buffer <<= 1;
-      bit_buffer |= get_bit()<<i;
-    }
-
-    // blk_rem_symbols--;
-    // check_update_block();
-    return bit_buffer;
-    
-  }*/
-
-
-  // this function can be optimize pointing directly to 
-  // the binary and removing the if 
-  int retrive_bits(int num_of_bits ){
-    unsigned int bits = (binary_buffer>>bit_ptr) & ((1<<num_of_bits)-1) ;
-    bit_ptr+=num_of_bits;
-
-    if(unlikely(bit_ptr >= BINARY_BLOCK_BITS)) {
-      binary_buffer >>= BINARY_BLOCK_BITS;
-      binary_buffer |= decltype(binary_buffer)(block_binary[binary_file_ptr])<<BINARY_BLOCK_BITS;
-      bit_ptr -= BINARY_BLOCK_BITS;
-      binary_file_ptr++;
-    }
-
+  inline int retrive_bits(int num_of_bits ){
+    assert(num_of_bits <= 32);
+    unsigned int bits = peek_bits() & ((uint64_t(1)<<num_of_bits)-1);
+    bit_pos += num_of_bits;
     return bits;
   }
   #else
@@ -562,9 +1354,17 @@ public:
   #endif
 
   int retrive_TSG_symbol(int theta_id, int p_id, uint escape_bits, int &z, int &y){  
+    if(num_ANS_states > 1) {
+      if(unlikely(!is_ANS_ready)) {init_ANS(); }
+      ANS_decoder_state = ANS_decoder_states[ANS_state_idx];
+    }
     // z first and y second
     z = Geometric_decoder(theta_id,escape_bits);
     y = Bernoulli_decoder(p_id);
+    if(num_ANS_states > 1) {
+      ANS_decoder_states[ANS_state_idx] = ANS_decoder_state;
+      ANS_state_idx = (ANS_state_idx+1) & (num_ANS_states-1);
+    }
     blk_rem_symbols--;
     check_update_block();
     return 0;
@@ -573,8 +1373,32 @@ public:
 private:
 
   // operations on binary file
+  #if SYMBOL_ENDIANNESS_LITTLE
+    // returns at least 57 bits starting at bit_pos
+    inline uint64_t peek_bits() const {
+      uint64_t bits;
+      memcpy(&bits,block_binary + (bit_pos>>3),sizeof(bits));
+      return bits >> (bit_pos & 7);
+    }
+
+    inline unsigned int get_byte(){
+      if(unlikely((bit_pos & 7) != 0)) {
+        std::cerr<<DBG_INFO<<" Warning: previous byte was being read. bit_ptr: "<<(bit_pos & 7)<<std::endl;
+        bit_pos = (bit_pos | 7) + 1; //go to next byte, discarding current
+      }
+      unsigned int symbol = block_binary[bit_pos>>3];
+      bit_pos += 8;
+      return symbol;
+    }
+
+    inline unsigned int get_bit(){
+      unsigned int bit = (block_binary[bit_pos>>3] >> (bit_pos & 7)) & 1;
+      bit_pos++;
+      return bit;
+    }
+  #else
     inline unsigned int get_byte(){
-      #if BIT_ENDIANNESS_LITTLE || SYMBOL_ENDIANNESS_LITTLE
+      #if BIT_ENDIANNESS_LITTLE
         if(unlikely((bit_ptr& 7) != 0)) {
       #else
         if(unlikely(bit_ptr != bit_ptr_init)) {
@@ -584,7 +1408,7 @@ private:
         //go to next byte, discarding current
 
         // #if BIT_ENDIANNESS_LITTLE 
-        #if BIT_ENDIANNESS_LITTLE || SYMBOL_ENDIANNESS_LITTLE
+        #if BIT_ENDIANNESS_LITTLE
 
           bit_ptr &= -8; // set lower bits to 0
           bit_ptr += 8;  // go to next byte
@@ -599,7 +1423,7 @@ private:
         #endif
       }
       unsigned int symbol;
-      #if BIT_ENDIANNESS_LITTLE || SYMBOL_ENDIANNESS_LITTLE
+      #if BIT_ENDIANNESS_LITTLE
         symbol = (binary_buffer>>bit_ptr) & 0xFF;
         bit_ptr += 8;
         if(bit_ptr >= BINARY_BLOCK_BITS) {
@@ -616,7 +1440,7 @@ private:
     }
 
     inline unsigned int get_bit(){
-      #if BIT_ENDIANNESS_LITTLE || SYMBOL_ENDIANNESS_LITTLE
+      #if BIT_ENDIANNESS_LITTLE
       unsigned int bit = (binary_buffer>>bit_ptr) & 1 ;
       #else
       unsigned int bit = (block_binary[binary_file_ptr]>>bit_ptr) & 1 ;
@@ -627,13 +1451,13 @@ private:
       // 
       // bit = bit != 0? 1 : 0;
 
-      #if BIT_ENDIANNESS_LITTLE || SYMBOL_ENDIANNESS_LITTLE
+      #if BIT_ENDIANNESS_LITTLE
       bit_ptr++;
       #else
       bit_ptr--;
       #endif
 
-      #if BIT_ENDIANNESS_LITTLE || SYMBOL_ENDIANNESS_LITTLE
+      #if BIT_ENDIANNESS_LITTLE
         if(bit_ptr >= BINARY_BLOCK_BITS) {
           binary_buffer >>= BINARY_BLOCK_BITS;
           binary_buffer |= decltype(binary_buffer)(block_binary[binary_file_ptr])<<BINARY_BLOCK_BITS;
@@ -648,28 +1472,25 @@ private:
       #endif
       return bit;
     }
-
-    /*inline unsigned int get_bit(){
-      unsigned int bit = block_binary[binary_file_ptr] & (1 << bit_ptr);
-      bit = bit != 0? 1 : 0;
-      bit_ptr--;
-      if(bit_ptr < 0) {
-        bit_ptr = bit_ptr_init;
-        binary_file_ptr++;
-      }
-      return bit;
-    }*/
+  #endif
 
 
 
   bool is_ANS_ready;
   uint ANS_decoder_state;
 
+  // interleaved ANS states (ANS_decoder_state is the one in use)
+  uint num_ANS_states;
+  uint ANS_state_idx;
+  uint ANS_decoder_states[MAX_INTERLEAVED_ANS_STATES];
+
+  const tANS_coder_tables_t* tables;
+  uint ee_buffer_size; // symbols per chunk
 
   inline void check_update_block(){
     if(unlikely(blk_rem_symbols == 0)) {
       tANS_finish_block();
-      blk_rem_symbols = remaining_symbols < EE_BUFFER_SIZE? remaining_symbols : EE_BUFFER_SIZE;
+      blk_rem_symbols = remaining_symbols < ee_buffer_size? remaining_symbols : ee_buffer_size;
       remaining_symbols -= blk_rem_symbols;
       if(remaining_symbols) {
         init_ANS();
@@ -677,91 +1498,70 @@ private:
     }
   }
 
-  // This function can be optimized using a lut to get the number of new
-  // bits to read from the input binary
-  auto tANS_z_decoder(uint mode){
-    static const uint8_t tANS_z_decode_table[NUM_ANS_THETA_MODES][NUM_ANS_STATES][2]{
-       #include "ANS_tables/tANS_z_decoder_table.dat"
-      }; // [0] number of bits, [1] next state
-    assert((ANS_decoder_state >= ANS_I_RANGE_START));
-    uint tANS_table_idx = ANS_decoder_state & tANS_STATE_MASK;
-    auto symbol = tANS_z_decode_table[mode][tANS_table_idx][ANS_SYMBOL];
-    ANS_decoder_state = tANS_z_decode_table[mode][tANS_table_idx][ANS_PREV_STATE];
-    assert((symbol >= 0));
-
-    #if SYMBOL_ENDIANNESS_LITTLE
-      // This can be done cause ANS_I_RANGE_START = 2^int
-      int new_bits = 0;
-      assert(ANS_decoder_state!=0);
-      while(ANS_decoder_state < ANS_I_RANGE_START) {
-        ANS_decoder_state <<=1; 
-        new_bits++;
-      }
-      if(new_bits) {
-        ANS_decoder_state |= retrive_bits(new_bits);
-      }
-    #else
-      while(ANS_decoder_state < ANS_I_RANGE_START) {
-        ANS_decoder_state *=2; // OPT: left shift
-        ANS_decoder_state |=  get_bit();
-      }
-    #endif
-
-    return symbol;
+  // renormalization bits are in the table, so the new state is read without
+  // loops or branches
+  inline uint tANS_decode(const tANS_dec_element_t &entry){
+    ANS_decoder_state = entry.state_base | retrive_bits(entry.num_of_bits);
+    return entry.symbol;
   }
 
-  // This function can be optimized using a lut to get the number of new
-  // bits to read from the input binary
-  auto tANS_y_decoder(uint mode){
-    static const uint8_t tANS_y_decode_table[NUM_ANS_P_MODES][NUM_ANS_STATES][2]{
-        #include "ANS_tables/tANS_y_decoder_table.dat"
-      }; // [0] number of bits, [1] next state
+  inline uint tANS_z_decoder(uint mode){
+    assert((ANS_decoder_state >= ANS_I_RANGE_START));
+    return tANS_decode(tables->z_dec.entry[mode][ANS_decoder_state & tANS_STATE_MASK]);
+  }
 
+  inline uint tANS_y_decoder(uint mode){
     assert((ANS_decoder_state >= ANS_I_RANGE_START));
-    uint tANS_table_idx = ANS_decoder_state & tANS_STATE_MASK;
-    auto symbol = tANS_y_decode_table[mode][tANS_table_idx][ANS_SYMBOL];
-    ANS_decoder_state = tANS_y_decode_table[mode][tANS_table_idx][ANS_PREV_STATE];
-    assert((symbol >= 0));
+    return tANS_decode(tables->y_dec.entry[mode][ANS_decoder_state & tANS_STATE_MASK]);
+  }
 
+  inline uint read_ANS_state(){
     #if SYMBOL_ENDIANNESS_LITTLE
-      int new_bits = 0;
-      // This can be done cause ANS_I_RANGE_START = 2^int
-      assert(ANS_decoder_state!=0);
-      while(ANS_decoder_state < ANS_I_RANGE_START) {
-        ANS_decoder_state <<=1; 
-        new_bits++;
-      }
-      if(new_bits) {
-        ANS_decoder_state |= retrive_bits(new_bits);
-      }
+    uint state = 1<< tANS_STATE_SIZE;
+    state |= retrive_bits(tANS_STATE_SIZE);
     #else
-      while(ANS_decoder_state < ANS_I_RANGE_START) {
-        ANS_decoder_state *=2; // OPT: left shift
-        ANS_decoder_state |=  get_bit();
-      }
+    uint state = 1; 
+    for(unsigned i = 0; i < tANS_STATE_SIZE; ++i) {
+      state <<=1;
+      state |= get_bit();
+    }
     #endif
-
-
-    return symbol;
+    return state;
   }
 
   void init_ANS(){
-    while(get_bit() == 0); // remove bit padding
+    // remove bit padding (upto 7 bits) and the bit marker
     #if SYMBOL_ENDIANNESS_LITTLE
-    ANS_decoder_state = 1<< tANS_STATE_SIZE;
-    ANS_decoder_state |= retrive_bits(tANS_STATE_SIZE);
+      const uint64_t bits = peek_bits();
+      if(unlikely(bits == 0)) {
+        std::cerr<<DBG_INFO<<"Error: ANS chunk bit marker not found"<<std::endl;
+        throw 1;
+      }
+      bit_pos += __builtin_ctzll(bits) +1;
     #else
-    ANS_decoder_state = 1; // 1 because i have just removed the bit marker
-    for(unsigned i = 0; i < tANS_STATE_SIZE; ++i) {
-      ANS_decoder_state <<=1;
-      ANS_decoder_state |= get_bit();
-    }
+      while(get_bit() == 0); 
     #endif
+    ANS_decoder_state = read_ANS_state(); // just after the bit marker
+    ANS_decoder_states[0] = ANS_decoder_state;
+    for(uint idx = 1; idx < num_ANS_states; ++idx) {
+      ANS_decoder_states[idx] = read_ANS_state();
+    }
+    ANS_state_idx = 0;
     
     is_ANS_ready = true;
   }
 
   void tANS_finish_block(){
+    for(uint idx = 1; idx < num_ANS_states; ++idx) {
+      if(unlikely((ANS_decoder_states[idx] != ANS_I_RANGE_START))){
+        std::cerr<<"Error: ANS decoder state "<<idx<<" ("<<ANS_decoder_states[idx] 
+              <<") should be zero at the end of the block"<<std::endl;
+        throw 1;
+      }
+    }
+    if(num_ANS_states > 1) {
+      ANS_decoder_state = ANS_decoder_states[0];
+    }
     if(unlikely((ANS_decoder_state != ANS_I_RANGE_START))){
       std::cerr<<"Error: ANS decoder state("<<ANS_decoder_state 
             <<") should be zero at the end of the block"<<std::endl;
@@ -800,26 +1600,36 @@ private:
   int Geometric_decoder(uint theta_id, uint escape_bits){
     if(unlikely(!is_ANS_ready)) {init_ANS(); }
     
-    const auto encoder_cardinality = tANS_cardinality_table[theta_id ];
-
-    // read first symbol using 
-    auto ans_symb = tANS_z_decoder(theta_id);
-    int module = ans_symb;
-
-    int it = 1;
-    while(ans_symb >= encoder_cardinality){
-      if(it >= EE_MAX_ITERATIONS) { // unlikely
-        module = retrive_bits(escape_bits);
-        break;
+    const auto encoder_cardinality = tables->rom.z_cardinality[theta_id ];
+    const auto run_table = tables->z_run_dec.run[theta_id];
+    const bool use_run_table = tables->z_run_dec.mode_has_runs[theta_id];
+
+    int module = 0;
+    int it = 0; // continue symbols decoded
+    while(true){
+      // continue symbols that don't need new bits
+      if(use_run_table) {
+        const tANS_z_run_dec_element_t run = run_table[ANS_decoder_state & tANS_STATE_MASK];
+        if(run.length != 0 && it + run.length <= EE_MAX_ITERATIONS) {
+          ANS_decoder_state = run.state;
+          module += run.length * encoder_cardinality;
+          it += run.length;
+          if(it >= EE_MAX_ITERATIONS) { // unlikely
+            return retrive_bits(escape_bits);
+          }
+        }
       }
 
-      ans_symb = tANS_z_decoder(theta_id);
+      auto ans_symb = tANS_z_decoder(theta_id);
       module += ans_symb;
+      if(ans_symb < encoder_cardinality) {
+        return module;
+      }
       it++;
+      if(it >= EE_MAX_ITERATIONS) { // unlikely
+        return retrive_bits(escape_bits);
+      }
     }
-    
-
-    return module;
   }
 
 
@@ -827,4 +1637,6 @@ private:
 
 
 
+} // namespace CODER_PROFILE_NS
+
 #endif // ANS_CODER_H
@@ -0,0 +1,193 @@
+/*
+  Copyright 2021 Tobías Alonso, Autonomous University of Madrid
+
+  This file is part of LOCO-ANS.
+
+  LOCO-ANS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  LOCO-ANS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with LOCO-ANS.  If not, see <https://www.gnu.org/licenses/>.
+
+
+ */
+
+#include "ANS_table_gen.h"
+#include "coder_config.h"
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+/* Symbol spread (get_class_table in ANS_functions.py):
+ * Each slot is assigned to the symbol with the lowest priority, which grows
+ * by 1/p each time the symbol gets a slot. Ties are resolved in favor of the
+ * least probable symbol. Every symbol gets at least one slot.
+ */
+static std::vector<int> get_class_table(const std::vector<double> &probs,int num_of_slots){
+  const int src_card = probs.size();
+  std::vector<double> priority(src_card);
+  std::vector<int> max_states_per_symb(src_card), symb_cnt(src_card,0);
+  for(int s = 0; s < src_card; ++s) {
+    assert(probs[s] > 0);
+    max_states_per_symb[s] = std::ceil(probs[s]*num_of_slots);
+    priority[s] = 1/(2*probs[s]);
+  }
+
+  std::vector<int> table;
+  int missing_symbols = src_card;
+  for(int i = 0; i < num_of_slots; ++i) {
+    const int remaining_slots = num_of_slots - i;
+    int symb_min = 0;
+    for(int s = 1; s < src_card; ++s) {
+      if(priority[s] < priority[symb_min]) {
+        symb_min = s;
+      }
+    }
+    for(int s = symb_min+1; s < src_card; ++s) {
+      if(priority[s] == priority[symb_min] && probs[s] < probs[symb_min]) {
+        symb_min = s;
+      }
+    }
+
+    if(missing_symbols == remaining_slots && symb_cnt[symb_min] != 0) {
+      break;
+    }
+
+    table.push_back(symb_min);
+    missing_symbols -= symb_cnt[symb_min] == 0;
+    symb_cnt[symb_min]++;
+    if(symb_cnt[symb_min] < max_states_per_symb[symb_min]) {
+      priority[symb_min] += 1/probs[symb_min];
+    }else{
+      priority[symb_min] = std::numeric_limits<double>::infinity();
+    }
+  }
+
+  // suboptimal table: the symbols that didn't get a slot are added at the end 
+  if(missing_symbols > 0) {
+    for(int s = 0; s < src_card; ++s) {
+      if(symb_cnt[s] == 0) {
+        table.push_back(s);
+      }
+    }
+  }
+  assert(int(table.size()) == num_of_slots);
+  return table;
+}
+
+// Compile_ANS_table in ANS_functions.py
+tANS_gen_tables_t build_tANS_tables(const std::vector<double> &probs,int log2_states){
+  const int num_of_states = 1<<log2_states;
+  const int src_card = probs.size();
+  const std::vector<int> table = get_class_table(probs,num_of_states);
+
+  // slots of each symbol
+  std::vector<std::vector<int>> symb_slots(src_card);
+  for(int state = 0; state < num_of_states; ++state) {
+    symb_slots[table[state]].push_back(state);
+  }
+
+  tANS_gen_tables_t tables;
+  tables.num_of_symbols = src_card;
+  tables.dec.resize(num_of_states);
+  tables.enc.assign(num_of_states*src_card,{0,-1});
+
+  // decoder: symbol s with F_s slots comes from the states [F_s,2*F_s)
+  std::vector<int> symb_cnt(src_card,0);
+  for(int state = 0; state < num_of_states; ++state) {
+    const int symbol = table[state];
+    tables.dec[state] = {symbol,int(symb_slots[symbol].size()) + symb_cnt[symbol]};
+    symb_cnt[symbol]++;
+  }
+
+  // encoder: renormalize the state to [F_s,2*F_s) and go to the slot
+  for(int symbol = 0; symbol < src_card; ++symbol) {
+    const int num_of_slots = symb_slots[symbol].size();
+    for(int state = 0; state < num_of_states; ++state) {
+      int x = num_of_states + state, bits = 0;
+      while(x >= 2*num_of_slots) {
+        x >>= 1;
+        bits++;
+      }
+      tables.enc[state*src_card + symbol] = {symb_slots[symbol][x - num_of_slots],bits};
+    }
+  }
+  return tables;
+}
+
+// get_p_modes in jpegls_ans.py
+double get_p_mode_param(int p_id){
+  const double precision_factor = std::ldexp(1.0,-CTX_NT_PRECISION);
+  #if CTX_NT_CENTERED_QUANT
+    return p_id == 0? std::ldexp(1.0,-(CTX_NT_PRECISION+2)) : p_id*precision_factor;
+  #else
+    return std::ldexp(1.0,-(CTX_NT_PRECISION+1)) + p_id*precision_factor;
+  #endif
+}
+
+// kld_minimizing_rec_value_for_const_ratio_uniform in Quantization_functions.py
+static double kld_minimizing_rec_value(double l, double h){
+  const double C = std::log2(1-l) - std::log2(1-h) + l/(1-l)*std::log2(l)
+                                                    - h/(1-h)*std::log2(h);
+  return std::pow(2.0,C/(l/(1-l)-h/(1-h)));
+}
+
+// bounds of the St quantizer bins: 2^n and 1.5*2^n
+static double get_St_bin_low_bound(int idx){
+  if(idx & 0x01) {
+    return 3*std::ldexp(1.0,(idx>>1)-2-CTX_ST_PRECISION);
+  }
+  return std::ldexp(1.0,(idx>>1)-1-CTX_ST_PRECISION);
+}
+
+// get_St_modes_const_ratio(_uniform_1) in jpegls_ans.py
+double get_St_mode_param(int theta_id, bool finer_quant){
+  if(finer_quant) {
+    const double low_b = get_St_bin_low_bound(theta_id);
+    const double high_b = get_St_bin_low_bound(theta_id+1);
+    const double rx = kld_minimizing_rec_value(low_b/(low_b+1),high_b/(high_b+1));
+    return rx/(1-rx);
+  }
+  return (1<<theta_id)*std::ldexp(1.0,-CTX_ST_PRECISION) * (1/std::pow(2,.5));
+}
+
+std::vector<double> get_y_source(double p){
+  return {1-p,p};
+}
+
+// get_symbol_src_geo in jpegls_ans.py (with min_symbols = 2)
+std::vector<double> get_z_source(double theta,int max_code_len,int max_symbols){
+  std::vector<double> probs;
+  double acc_prob = 0;
+  for(int i = 0; i < max_symbols; ++i) {
+    const double new_sym_prob = (1-theta)*std::pow(theta,i);
+    const double code_len_rem = -std::log2(1 - (acc_prob + new_sym_prob));
+    if(code_len_rem > max_code_len && i >= 1) {
+      break;
+    }
+    probs.push_back(new_sym_prob);
+    acc_prob += new_sym_prob;
+  }
+
+  // power of 2 number of symbols (+ the remainder)
+  size_t num_of_symbols = 1;
+  while(num_of_symbols*2 <= probs.size()) {
+    num_of_symbols *= 2;
+  }
+  probs.resize(num_of_symbols);
+
+  acc_prob = 0;
+  for(double p: probs) {
+    acc_prob += p;
+  }
+  probs.push_back(1-acc_prob);
+  return probs;
+}
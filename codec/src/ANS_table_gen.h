@@ -0,0 +1,69 @@
+/*
+  Copyright 2021 Tobías Alonso, Autonomous University of Madrid
+
+  This file is part of LOCO-ANS.
+
+  LOCO-ANS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  LOCO-ANS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with LOCO-ANS.  If not, see <https://www.gnu.org/licenses/>.
+
+
+ */
+
+#ifndef ANS_TABLE_GEN_H
+#define ANS_TABLE_GEN_H
+
+#include <vector>
+#include <stdint.h>
+
+/* tANS table generator:
+ * C++ version of the table generation in notebooks/jpegls_ans.py (and
+ * ANS_functions.py), which produces the same tables as the ones in ANS_tables.
+ * It allows to build the tables at startup (see ANS_TABLES_GENERATED) from the
+ * parameters in coder_config.h, without the python toolchain. The parameters
+ * that depend on the coder profile are arguments.
+ * States are in the I range [2^log2_states, 2^(log2_states+1)). Table indexes
+ * are relative to the I range start.
+ */
+
+struct tANS_gen_enc_entry_t {
+  int next_state; // relative to the I range start
+  int bits; // bits to output (-1: symbol not in the source)
+};
+
+struct tANS_gen_dec_entry_t {
+  int symbol;
+  int prev_state; // state before renormalization (absolute)
+};
+
+struct tANS_gen_tables_t {
+  int num_of_symbols;
+  std::vector<tANS_gen_enc_entry_t> enc; // [state*num_of_symbols + symbol]
+  std::vector<tANS_gen_dec_entry_t> dec; // [state]
+};
+
+// probs: symbol probabilities (the last one is the remaining probability)
+tANS_gen_tables_t build_tANS_tables(const std::vector<double> &probs,int log2_states);
+
+// Coder modes (as in coder_config_gen.ipynb)
+double get_p_mode_param(int p_id); // P(y==1)
+// St, theta = St/(St+1). finer_quant: CTX_ST_FINER_QUANT of the coder profile
+double get_St_mode_param(int theta_id, bool finer_quant);
+
+// y source: {P(y==0), P(y==1)}
+std::vector<double> get_y_source(double p);
+
+// z source: first symbols of a geometric distribution (a power of 2 of them,
+// at least 1) plus the remainder symbol, which needs at most max_code_len bits
+std::vector<double> get_z_source(double theta,int max_code_len,int max_symbols);
+
+#endif /* ANS_TABLE_GEN_H */
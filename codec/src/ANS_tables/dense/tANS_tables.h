@@ -0,0 +1,17 @@
+// tANS tables of the dense coder profile, written by tools/ans_table_gen
+// (included by ANS_coder.h, see ANS_TABLES_FILE)
+static const tANS_table_t tANS_z_encode_table[NUM_ANS_THETA_MODES][NUM_ANS_STATES][ANS_MAX_SRC_CARDINALITY]{
+  #include "tANS_z_encoder_table.dat"
+};
+static const tANS_table_t tANS_y_encode_table[NUM_ANS_P_MODES][NUM_ANS_STATES][2]{
+  #include "tANS_y_encoder_table.dat"
+};
+static const tANS_state_t tANS_z_decode_table[NUM_ANS_THETA_MODES][NUM_ANS_STATES][2]{
+  #include "tANS_z_decoder_table.dat"
+};
+static const tANS_state_t tANS_y_decode_table[NUM_ANS_P_MODES][NUM_ANS_STATES][2]{
+  #include "tANS_y_decoder_table.dat"
+};
+static const uint8_t tANS_z_cardinality[NUM_ANS_THETA_MODES]{
+  #include "tANS_z_cardinality_table.dat"
+};
@@ -0,0 +1,321 @@
+/*
+  Copyright 2021 Tobías Alonso, Autonomous University of Madrid
+
+  This file is part of LOCO-ANS.
+
+  LOCO-ANS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  LOCO-ANS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with LOCO-ANS.  If not, see <https://www.gnu.org/licenses/>.
+
+
+ */
+
+#include "batch.h"
+#include "codec.h"
+
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define COMPRESSED_FILE_EXT ".jls_ans"
+
+struct batch_record_t {
+  std::string input;
+  std::string output;
+  int near = -1; // -1: decoder record
+  int width = 0;
+  int height = 0;
+  double time = 0; // codec time (s), excluding image read/write
+  double bpp = 0;
+  bool ok = false;
+};
+
+static double get_time(){
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec+t.tv_nsec* 1E-9;
+}
+
+static bool is_regular_file(const std::string &path){
+  struct stat st;
+  return stat(path.c_str(),&st) == 0 && S_ISREG(st.st_mode);
+}
+
+static bool has_suffix(const std::string &str, const std::string &suffix){
+  return str.size() >= suffix.size() && 
+          str.compare(str.size()-suffix.size(),suffix.size(),suffix) == 0;
+}
+
+// input: directory or file with one path per line. In a directory, only the 
+// files ending with suffix are used
+static bool get_input_files(const std::string &input, std::vector<std::string> &files,
+                                              const std::string &suffix = ""){
+  DIR* dir = opendir(input.c_str());
+  if(dir != nullptr) {
+    while(struct dirent* entry = readdir(dir)) {
+      if(entry->d_name[0] == '.') {
+        continue;
+      }
+      std::string path = input + "/" + entry->d_name;
+      if(has_suffix(path,suffix) && is_regular_file(path)) {
+        files.push_back(path);
+      }
+    }
+    closedir(dir);
+    std::sort(files.begin(),files.end());
+    return true;
+  }
+
+  std::ifstream list_file(input);
+  if(!list_file) {
+    return false;
+  }
+  std::string line;
+  while(std::getline(list_file,line)) {
+    line.erase(line.find_last_not_of(" \t\r")+1);
+    if(!line.empty() && line[0] != '#') {
+      files.push_back(line);
+    }
+  }
+  return true;
+}
+
+// file name without directory and extension
+static std::string get_stem(const std::string &path){
+  size_t start = path.find_last_of('/');
+  start = start == std::string::npos? 0 : start+1;
+  size_t end = path.find_last_of('.');
+  if(end == std::string::npos || end <= start) {
+    end = path.size();
+  }
+  return path.substr(start,end-start);
+}
+
+// The outputs are named after the input file name (get_stem), so inputs with
+// the same name (ex: a/img.pgm and b/img.pgm) would overwrite each other
+static bool check_output_names(const std::vector<std::string> &files){
+  std::map<std::string,const std::string*> stems;
+  for(const auto &file: files) {
+    const auto entry = stems.emplace(get_stem(file),&file);
+    if(!entry.second) {
+      std::cerr<<"Error: Batch inputs with the same output name: "
+                <<*entry.first->second<<" and "<<file<<std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string json_escape(const std::string &str){
+  std::string out;
+  for(char c: str) {
+    if(c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out;
+}
+
+static std::string csv_escape(const std::string &str){
+  std::string out = "\"";
+  for(char c: str) {
+    out += c;
+    if(c == '"') {
+      out += '"';
+    }
+  }
+  return out + "\"";
+}
+
+static bool write_summary(const std::string &path,
+                            const std::vector<batch_record_t> &records){
+  std::ofstream out(path);
+  if(!out) {
+    std::cerr<<"Error: Can't write batch summary: "<<path<<std::endl;
+    return false;
+  }
+
+  const bool json = has_suffix(path,".json");
+  char line[128];
+  if(json) {
+    out<<"[\n";
+  }else{
+    out<<"input,output,near,width,height,time,mps,bpp,status\n";
+  }
+  for(size_t i = 0; i < records.size(); ++i) {
+    const batch_record_t &r = records[i];
+    const double mps = r.time > 0? r.width*r.height/(1024*1024*r.time) : 0;
+    if(json) {
+      snprintf(line,sizeof(line),"\"near\": %d, \"width\": %d, \"height\": %d, "
+        "\"time\": %.6f, \"mps\": %.3f, \"bpp\": %.4f, ",
+        r.near,r.width,r.height,r.time,mps,r.bpp);
+      out<<"  {\"input\": \""<<json_escape(r.input)<<"\", \"output\": \""
+         <<json_escape(r.output)<<"\", "<<line<<"\"status\": \""
+         <<(r.ok? "ok":"error")<<"\"}"<<(i+1 < records.size()? ",\n" : "\n");
+    }else{
+      snprintf(line,sizeof(line),"%d,%d,%d,%.6f,%.3f,%.4f,",
+        r.near,r.width,r.height,r.time,mps,r.bpp);
+      out<<csv_escape(r.input)<<","<<csv_escape(r.output)<<","<<line
+         <<(r.ok? "ok":"error")<<"\n";
+    }
+  }
+  if(json) {
+    out<<"]\n";
+  }
+  return bool(out);
+}
+
+static int finish_batch(const std::string &out_dir,const batch_config_t &config,
+                      const std::vector<batch_record_t> &records, double batch_time){
+  int errors = 0;
+  double pixels = 0;
+  for(auto &r: records) {
+    if(r.ok) {
+      pixels += double(r.width)*r.height;
+    }else{
+      std::cerr<<"Error processing: "<<r.input<<std::endl;
+      errors++;
+    }
+  }
+
+  const std::string summary_path = config.summary_path.empty()?
+                            out_dir+"/batch_summary.csv" : config.summary_path;
+  write_summary(summary_path,records);
+  printf("Batch: %zu runs | errors: %d | time: %.3f | BW: %.3f MP/s \n",
+              records.size(),errors,batch_time,pixels/(1024*1024*batch_time));
+  std::cout<<"Summary: "<<summary_path<<std::endl;
+  return errors;
+}
+
+int batch_encode(const std::string &input,const std::string &out_dir,
+                                            const batch_config_t &config){
+  std::vector<std::string> files;
+  if(!get_input_files(input,files)) {
+    std::cerr<<"Error: Can't read batch input: "<<input<<std::endl;
+    return -1;
+  }
+  if(!check_output_names(files)) {
+    return -1;
+  }
+
+  const int num_of_files = files.size();
+  const int num_of_nears = config.near_list.size();
+  std::vector<batch_record_t> records(num_of_files*num_of_nears);
+  const double ini = get_time();
+
+  // each image is read once and coded with every NEAR
+  #pragma omp parallel for schedule(dynamic) num_threads(config.workers)
+  for(int file_idx = 0; file_idx < num_of_files; ++file_idx) {
+    cv::Mat img = cv::imread(files[file_idx],cv::IMREAD_UNCHANGED);
+    for(int near_idx = 0; near_idx < num_of_nears; ++near_idx) {
+      batch_record_t &r = records[file_idx*num_of_nears+near_idx];
+      r.input = files[file_idx];
+      r.near = config.near_list[near_idx];
+      r.output = out_dir+"/"+get_stem(r.input)+"_n"+std::to_string(r.near)
+                                                            +COMPRESSED_FILE_EXT;
+      if(img.empty() || img.type() != CV_8UC1) {
+        continue;
+      }
+      r.width = img.cols;
+      r.height = img.rows;
+
+      std::vector<char> out_file(r.output.begin(),r.output.end());
+      out_file.push_back('\0');
+      const int blk_height = config.blk_height > 0? config.blk_height : img.rows;
+      const int blk_width = config.blk_width > 0? config.blk_width : img.cols;
+      try{
+        const double t = get_time();
+        int compress_img_size = encoder(img,out_file.data(),blk_width,blk_height,
+                    CHROMA_MODE_GRAY,ENCODER_PRED_LOCO,r.near,ENCODER_MODE_ENCODE,8,
+                    config.threads,config.add_block_index,config.pipelined,
+                    config.num_ANS_states,config.strip_mode,config.two_pass,
+                    config.ee_buffer_size,config.static_model,config.coder_profile);
+        r.time = get_time()-t;
+        r.ok = compress_img_size >= 0; // -1: invalid arguments
+        r.bpp = double(compress_img_size)*8/(double(img.cols)*img.rows);
+      }catch(...){
+        r.ok = false;
+      }
+    }
+  }
+
+  return finish_batch(out_dir,config,records,get_time()-ini);
+}
+
+int batch_decode(const std::string &input,const std::string &out_dir,
+                                            const batch_config_t &config){
+  std::vector<std::string> files;
+  if(!get_input_files(input,files,COMPRESSED_FILE_EXT)) {
+    std::cerr<<"Error: Can't read batch input: "<<input<<std::endl;
+    return -1;
+  }
+  if(!check_output_names(files)) {
+    return -1;
+  }
+
+  const int num_of_files = files.size();
+  std::vector<batch_record_t> records(num_of_files);
+  const double ini = get_time();
+
+  #pragma omp parallel for schedule(dynamic) num_threads(config.workers)
+  for(int file_idx = 0; file_idx < num_of_files; ++file_idx) {
+    batch_record_t &r = records[file_idx];
+    r.input = files[file_idx];
+    r.output = out_dir+"/"+get_stem(r.input)+".pgm";
+
+    std::vector<char> in_file(r.input.begin(),r.input.end());
+    in_file.push_back('\0');
+    cv::Mat decode_img;
+    try{
+      const double t = get_time();
+      // per-file prints would be interleaved by the workers
+      int deco_status = decoder(in_file.data(),decode_img,true,config.threads,false);
+      r.time = get_time()-t;
+      r.ok = deco_status == 0 && cv::imwrite(r.output,decode_img);
+    }catch(...){
+      r.ok = false;
+    }
+    r.width = decode_img.cols;
+    r.height = decode_img.rows;
+    if(r.ok) {
+      std::ifstream in(r.input, std::ios::binary | std::ios::ate);
+      r.bpp = double(in.tellg())*8/(r.width*r.height);
+    }
+  }
+
+  return finish_batch(out_dir,config,records,get_time()-ini);
+}
+
+bool parse_near_list(const char* str, std::vector<int> &near_list){
+  near_list.clear();
+  while(*str != '\0') {
+    char* end;
+    long near = strtol(str,&end,10);
+    if(end == str || near < 0 || near > MAX_NEAR) {
+      return false;
+    }
+    near_list.push_back(near);
+    str = *end == ','? end+1 : end;
+    if(*end != ',' && *end != '\0') {
+      return false;
+    }
+  }
+  return !near_list.empty();
+}
@@ -0,0 +1,67 @@
+/*
+  Copyright 2021 Tobías Alonso, Autonomous University of Madrid
+
+  This file is part of LOCO-ANS.
+
+  LOCO-ANS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  LOCO-ANS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with LOCO-ANS.  If not, see <https://www.gnu.org/licenses/>.
+
+
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "coder_config.h"
+
+/* Batch mode: encodes or decodes a set of files inside one process, using a
+ * pool of workers (each worker processes a whole file). The input is either a
+ * directory or a text file with one path per line. From a directory, the 
+ * encoder takes all the regular files and the decoder the .jls_ans files, 
+ * which is the extension of the encoder outputs. A summary with a record per
+ * processed file (and NEAR) is written in CSV or JSON format (selected with 
+ * the summary file extension)
+ */
+
+struct batch_config_t {
+  std::vector<int> near_list; // encoder: each file is coded with every NEAR
+  int blk_height = -1; // <=0: image height
+  int blk_width = -1; // <=0: image width
+  int workers = 1; // files processed concurrently
+  int threads = 1; // threads used for the blocks of each file
+  bool add_block_index = true;
+  bool pipelined = false;
+  int num_ANS_states = 1;
+  bool strip_mode = false;
+  bool two_pass = false;
+  int ee_buffer_size = EE_BUFFER_SIZE; // symbols per tANS chunk
+  bool static_model = false;
+  int coder_profile = CODER_PROFILE_DEFAULT;
+  std::string summary_path; // empty: out_dir/batch_summary.csv
+};
+
+// Both return the number of files that could not be processed (or -1 if the
+// input could not be read or two inputs have the same file name, as the 
+// outputs are named after it)
+int batch_encode(const std::string &input,const std::string &out_dir,
+                                              const batch_config_t &config);
+int batch_decode(const std::string &input,const std::string &out_dir,
+                                              const batch_config_t &config);
+
+// parses a comma separated list of NEAR values (ex: "0,1,3")
+bool parse_near_list(const char* str, std::vector<int> &near_list);
+
+#endif /* BATCH_H */
@@ -24,14 +24,42 @@
 
 
 int encoder(const cv::Mat& src_img,char* out_file,int block_width,int block_height, 
-  int chroma_mode, char prediction,int NEAR, char encoder_mode, int ibpp ){
+  int chroma_mode, char prediction,int NEAR, char encoder_mode, int ibpp, int threads,
+  bool add_block_index, bool pipelined, int num_ANS_states, bool strip_mode,
+  bool two_pass, int ee_buffer_size, bool static_model, int coder_profile){
 
   if(NEAR > MAX_NEAR) {
     std::cerr<<" The header used in this version does not support NEAR > "<<MAX_NEAR<<std::endl;
-    return 1;
+    return -1;
   }else if(NEAR < 0) {
     std::cerr<<" Error: NEAR should be >= 0"<<std::endl;
-    return 1;
+    return -1;
+  }
+
+  if(num_ANS_states != 1 && num_ANS_states != 2 && num_ANS_states != 4) {
+    std::cerr<<" Error: Supported number of interleaved ANS states: 1, 2 or 4"<<std::endl;
+    return -1;
+  }
+
+  if(get_coder_profile_api(coder_profile) == nullptr) {
+    std::cerr<<" Error: Unknown coder profile: "<<coder_profile<<std::endl;
+    return -1;
+  }
+
+  if(ee_buffer_size < EE_BUFFER_MIN_SIZE || (ee_buffer_size & (ee_buffer_size-1)) != 0 ||
+                          ee_buffer_size > (EE_BUFFER_MIN_SIZE << EE_BUFFER_MAX_EXP)) {
+    std::cerr<<" Error: The tANS chunk size should be a power of 2 between "
+      <<EE_BUFFER_MIN_SIZE<<" and "<<(EE_BUFFER_MIN_SIZE << EE_BUFFER_MAX_EXP)<<std::endl;
+    return -1;
+  }
+  
+  if(strip_mode) {
+    // the first columns of a strip use the 2 last columns of the left strip
+    if(block_width < 2) {
+      std::cerr<<" Error: Strip mode requires a block width >= 2"<<std::endl;
+      return -1;
+    }
+    block_height = src_img.rows;
   }
   
   bool save_to_file = true;
@@ -53,15 +81,46 @@ int encoder(const cv::Mat& src_img,char* out_file,int block_width,int block_heig
       header.color_profile= chroma_mode;
       header.ibpp=ibpp ;        
       header.predictor = prediction;
-      header.ee_buffer_exp = uint(std::log2(EE_BUFFER_SIZE/32));
+      header.ee_buffer_exp = uint(std::log2(ee_buffer_size/EE_BUFFER_MIN_SIZE));
       header.NEAR = NEAR ;        
       header.blk_height = block_height;
       header.blk_width = block_width;
       header.img_height =src_img.rows; 
       header.img_width = src_img.cols;
+      if(add_block_index) {
+        header.flags |= GL_FLAG_BLOCK_INDEX;
+      }
+      header.set_num_ANS_states(num_ANS_states);
+      if(strip_mode) {
+        header.flags |= GL_FLAG_STRIP_MODE;
+      }
+      header.flags |= GL_FLAG_BLOCK_TYPES;
+      if(coder_profile != CODER_PROFILE_DEFAULT) {
+        header.flags |= GL_FLAG_CODER_PROFILE;
+        header.coder_profile = coder_profile;
+      }
+      const size_t block_header_size = get_block_header_size(header);
+
+    //two-pass mode: tANS tables tuned for the image
+      std::vector<uint8_t> table_section;
+      std::shared_ptr<const tANS_coder_tables_t> tANS_tables;
+      if(two_pass) {
+        tANS_tables = get_image_tANS_tables(src_img,NEAR,ibpp,table_section,
+                                                    static_model,coder_profile);
+      }
+      if(tANS_tables) {
+        header.flags |= GL_FLAG_IMAGE_TABLES;
+      }
 
       std::ofstream binary_out_file(out_file,std::ios::binary); //out file
-      binary_out_file.write((char*)&(header),sizeof(header));
+      binary_out_file.write((char*)&(header),header.size());
+      size_t first_block_offset = header.size();
+      if(tANS_tables) {
+        const table_section_size_t section_size = table_section.size();
+        binary_out_file.write((char*)&section_size,sizeof(section_size));
+        binary_out_file.write((char*)table_section.data(),section_size);
+        first_block_offset += sizeof(section_size) + section_size;
+      }
     
 
   //generate blocks
@@ -75,88 +134,332 @@ int encoder(const cv::Mat& src_img,char* out_file,int block_width,int block_heig
       codec_input_img = src_img;
     }
 
-    int compress_img_size=sizeof(global_header);
+    // strip mode: in near-lossless, the left strip reconstructed values are 
+    // needed. Blocks write them in their view of recon_img
+    cv::Mat recon_img;
+    if(strip_mode && NEAR > 0) {
+      recon_img.create(src_img.rows,src_img.cols,src_img.type());
+    }
+    auto get_quant_block = [&](int blk_col){
+      if(recon_img.empty()) {
+        return cv::Mat();
+      }
+      int col_low = blk_col*block_width;
+      int col_high = MIN((blk_col+1)*block_width,src_img.cols); 
+      return recon_img(cv::Range::all(),cv::Range(col_low,col_high)); 
+    };
+
+    int compress_img_size=first_block_offset;
+    std::vector<block_location> block_index;
     uint8_t* block_buffer;
-    uint32_t max_output_size=((block_height*block_width*MAX_SUPPORTED_BPP/8)/(sizeof (*block_buffer))+1); //for no chroma sub-sampling
-    block_buffer = new uint8_t[max_output_size];
-
-    for (int blk_row = 0; blk_row < blk_rows; ++blk_row) {
-      for (int blk_col = 0; blk_col < blk_cols; ++blk_col) {
-        //map a portion of the input image to a block
-        int row_low = blk_row*block_height;
-        int row_high = MIN((blk_row+1)*block_height,src_img.rows);
-        int col_low = blk_col*block_width;
-        int col_high = MIN((blk_col+1)*block_width,src_img.cols); 
-        block=codec_input_img(cv::Range(row_low,row_high),cv::Range(col_low,col_high)); 
-        cv::Mat quant_block;
-        uint32_t out_file_size;
-
-        out_file_size=encode_core(block,quant_block,block_buffer,chroma_mode,
-                          prediction,NEAR, encoder_mode,ibpp);
-      
+    uint32_t max_output_size=((block_height*block_width*MAX_SUPPORTED_BPP/8)/(sizeof (*block_buffer))
+                                +ENCODER_OUTPUT_PADDING+STATIC_MODEL_MAX_SIZE); //for no chroma sub-sampling
+
+    auto get_block = [&](int blk_row, int blk_col){
+      //map a portion of the input image to a block
+      int row_low = blk_row*block_height;
+      int row_high = MIN((blk_row+1)*block_height,src_img.rows);
+      int col_low = blk_col*block_width;
+      int col_high = MIN((blk_col+1)*block_width,src_img.cols); 
+      return codec_input_img(cv::Range(row_low,row_high),cv::Range(col_low,col_high)); 
+    };
+
+    auto store_block = [&](const uint8_t* block_data, uint32_t out_file_size,
+                                                        uint8_t block_type){
+      block_location location;
+      location.offset = block_index.empty()? first_block_offset : 
+              block_index.back().offset + block_header_size + block_index.back().size;
+      location.size = out_file_size;
+      block_index.push_back(location);
+
+      compress_img_size+= (int)out_file_size;
+      compress_img_size+= block_header_size;
+      if(save_to_file) {
+        //store block header
+          struct block_header block_header;
+          block_header.size = out_file_size;
+          block_header.type = block_type;
+          binary_out_file.write((char*)&(block_header),block_header_size);
 
-        compress_img_size+= (int)out_file_size;
-        compress_img_size+= sizeof(block_header);
-        if(save_to_file) {
-          //store block header
-            struct block_header block_header;
-            block_header.size = out_file_size;
-            binary_out_file.write((char*)&(block_header),sizeof(block_header));
+        binary_out_file.write((char*)block_data,out_file_size); //store block data
+      }
+    };
+
+    if(threads <= 1) {
+      block_buffer = new uint8_t[max_output_size];
+
+      for (int blk_row = 0; blk_row < blk_rows; ++blk_row) {
+        for (int blk_col = 0; blk_col < blk_cols; ++blk_col) {
+          block=get_block(blk_row,blk_col);
+          cv::Mat quant_block = get_quant_block(blk_col);
+          uint32_t out_file_size;
+          uint8_t block_type;
+
+          // left strip is already coded, no need to sync
+          strip_link_t strip;
+          strip.has_left_strip = blk_col > 0;
+
+          out_file_size=encode_core(block,quant_block,block_buffer,chroma_mode,
+                            prediction,NEAR, encoder_mode,ibpp,pipelined,
+                            num_ANS_states,strip_mode? &strip : nullptr,
+                            tANS_tables.get(),ee_buffer_size,&block_type,
+                            static_model,coder_profile);
+        
+          store_block(block_buffer,out_file_size,block_type);
+        }
+      }
 
-          binary_out_file.write((char*)block_buffer,out_file_size); //store block data
+      delete[] block_buffer;
+    }else{
+      // Blocks are independent, so they are encoded concurrently. Each 
+      // binary is kept until all blocks are done, and then they are stored 
+      // in the same order as in the serial path (output is the same)
+      // In near-lossless strip mode, strips are encoded as a wavefront, as 
+      // each row requires the reconstructed row of the left strip
+      const int num_of_blocks = blk_rows*blk_cols;
+      std::vector<std::vector<uint8_t>> block_binaries(num_of_blocks);
+      std::vector<uint8_t> block_types(num_of_blocks);
+      std::vector<std::atomic<int>> rows_done(strip_mode? num_of_blocks : 0);
+      for(auto & strip_rows_done: rows_done) {
+        strip_rows_done.store(0);
+      }
+      bool encode_error = false;
+
+      #pragma omp parallel num_threads(threads)
+      {
+        uint8_t* thread_block_buffer = new uint8_t[max_output_size];
+
+        #pragma omp for schedule(dynamic)
+        for(int blk_idx = 0; blk_idx < num_of_blocks; ++blk_idx) {
+          const int blk_col = blk_idx%blk_cols;
+          cv::Mat thread_block = get_block(blk_idx/blk_cols,blk_col);
+          cv::Mat quant_block = get_quant_block(blk_col);
+          strip_link_t strip;
+          strip.has_left_strip = blk_col > 0;
+          if(!recon_img.empty()) {
+            strip.left_rows_done = blk_col > 0? &rows_done[blk_idx-1] : nullptr;
+            strip.rows_done = &rows_done[blk_idx];
+          }
+          try{
+            uint32_t out_file_size=encode_core(thread_block,quant_block,
+                        thread_block_buffer,chroma_mode,prediction,NEAR, 
+                        encoder_mode,ibpp,pipelined,num_ANS_states,
+                        strip_mode? &strip : nullptr,tANS_tables.get(),
+                        ee_buffer_size,&block_types[blk_idx],static_model,
+                        coder_profile);
+            block_binaries[blk_idx].assign(thread_block_buffer,
+                                          thread_block_buffer+out_file_size);
+          }catch(...){
+            // exceptions can't leave the parallel region
+            #pragma omp atomic write
+            encode_error = true;
+            if(strip.rows_done != nullptr) {
+              strip.rows_done->store(thread_block.rows); // release right strip
+            }
+          }
         }
+
+        delete[] thread_block_buffer;
+      }
+
+      if(encode_error) {
+        std::cerr<<DBG_INFO<<"Error encoding image blocks"<<std::endl;
+        throw 1;
+      }
+
+      for(int blk_idx = 0; blk_idx < num_of_blocks; ++blk_idx) {
+        store_block(block_binaries[blk_idx].data(),block_binaries[blk_idx].size(),
+                                                            block_types[blk_idx]);
       }
     }
 
 
+    //store block index footer
+    if(add_block_index) {
+      block_index_trailer trailer;
+      trailer.index_offset = compress_img_size;
+      trailer.num_of_blocks = block_index.size();
+      trailer.magic = BLOCK_INDEX_MAGIC;
+      compress_img_size += block_index.size()*sizeof(block_location) + sizeof(trailer);
+      if(save_to_file) {
+        binary_out_file.write((char*)block_index.data(),
+                                    block_index.size()*sizeof(block_location));
+        binary_out_file.write((char*)&trailer,sizeof(trailer));
+      }
+    }
+
     binary_out_file.close();
   
-
-    delete[] block_buffer;
     return compress_img_size;
 }
 
 
 
-int decoder(char* in_file,cv::Mat &dst_img, bool scale_depth){
-  //open LOCO-ANS-coded image
-    std::ifstream binary_in_file(in_file, std::ios::binary );
+// max_block_data_size has to be a bit bigger than actual max size to avoid
+// segfaults due to how the binary is read (the decoder reads 64-bit words at
+// any byte of the binary)
+static size_t get_max_block_data_size(const global_header &header,int num_of_channels){
+  return header.blk_height*header.blk_width*num_of_channels*
+                    (1+int(MAX_SUPPORTED_BPP/8)/sizeof(char))+DECODER_INPUT_PADDING+
+                    STATIC_MODEL_MAX_SIZE;
+}
 
-  //extract file header
-    struct global_header header;
-    binary_in_file.read((char*)&header,sizeof(header));
+bool read_global_header(std::ifstream &binary_in_file, global_header &header,
+                                    std::vector<uint8_t> &table_section){
+  // read the fields common to all versions first 
+  binary_in_file.read((char*)&header,offsetof(global_header,flags));
+  header.flags = 0;
+  header.coder_profile = CODER_PROFILE_DEFAULT;
+  if(binary_in_file && header.version >= 3) {
+    binary_in_file.read((char*)&header.flags,sizeof(header.flags));
+    if(header.flags & GL_FLAG_CODER_PROFILE) {
+      binary_in_file.read((char*)&header.coder_profile,sizeof(header.coder_profile));
+    }
+  }
+
+  table_section.clear();
+  if(binary_in_file && (header.flags & GL_FLAG_IMAGE_TABLES)) {
+    table_section_size_t section_size = 0;
+    binary_in_file.read((char*)&section_size,sizeof(section_size));
+    table_section.resize(section_size);
+    binary_in_file.read((char*)table_section.data(),section_size);
+  }
+  return bool(binary_in_file);
+}
+
+// Reads the block index and checks that every block is between the first 
+// block position (first_block_pos) and the index, and fits in the block 
+// binary buffer
+static bool read_block_index(std::ifstream &binary_in_file,const global_header &header,
+            uint64_t first_block_pos, int num_of_blocks, size_t max_block_data_size,
+            std::vector<block_location> &block_locations){
+  block_index_trailer trailer;
+  binary_in_file.seekg(-int(sizeof(trailer)),std::ios::end);
+  binary_in_file.read((char*)&trailer,sizeof(trailer));
+  if(!binary_in_file || trailer.magic != BLOCK_INDEX_MAGIC || 
+                          trailer.num_of_blocks != uint32_t(num_of_blocks) ||
+                          trailer.index_offset < first_block_pos) {
+    return false;
+  }
+
+  block_locations.resize(num_of_blocks);
+  binary_in_file.seekg(trailer.index_offset);
+  binary_in_file.read((char*)block_locations.data(),
+                                    num_of_blocks*sizeof(block_location));
+  if(!binary_in_file) {
+    return false;
+  }
+
+  const uint64_t block_header_size = get_block_header_size(header);
+  for(const auto & location: block_locations) {
+    if(location.offset < first_block_pos || 
+        location.size > max_block_data_size - DECODER_INPUT_PADDING ||
+        location.offset + block_header_size + location.size > trailer.index_offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool get_block_locations(std::ifstream &binary_in_file,const global_header &header,
+            int num_of_blocks, size_t max_block_data_size,
+            std::vector<block_location> &block_locations){
+  if(header.flags & GL_FLAG_BLOCK_INDEX) {
+    const auto first_block_pos = binary_in_file.tellg();
+    if(read_block_index(binary_in_file,header,first_block_pos,num_of_blocks,
+                                        max_block_data_size,block_locations)) {
+      return true;
+    }
+    std::cerr<<"Warning: Invalid block index. Scanning block headers"<<std::endl;
+    binary_in_file.clear();
+    binary_in_file.seekg(first_block_pos);
+  }
+
+  block_locations.resize(num_of_blocks);
+  for(auto & location: block_locations) {
+    struct block_header block_header;
+    location.offset = binary_in_file.tellg();
+    if(!binary_in_file.read((char*)&(block_header),get_block_header_size(header)) ||
+                block_header.size > max_block_data_size - DECODER_INPUT_PADDING) {
+      return false;
+    }
+    location.size = block_header.size;
+    binary_in_file.seekg(block_header.size,std::ios::cur);
+  }
+  return bool(binary_in_file);
+}
+
+// Reads the global header and checks that the compressed image is supported.
+// tANS_tables is set to the image tables (nullptr if not present). The image
+// configuration is printed if verbose.
+// Returns the number of channels
+static int read_and_check_header(std::ifstream &binary_in_file,global_header &header,
+                      std::shared_ptr<const tANS_coder_tables_t> &tANS_tables,
+                      bool verbose = true){
+    std::vector<uint8_t> table_section;
+    if(!read_global_header(binary_in_file,header,table_section)) {
+      std::cerr<<"Error: Can't read compressed image header"<<std::endl;
+      throw 1;
+    }
 
     if(!header.check_version() ) {
       std::cerr<<"Compressed image format not supported. version mismatch."<<std::endl;
       std::cerr<<"Compressed image version:"<< int(header.version)<<std::endl;
       throw 1;
     }
-    
-    uint32_t blk_height=header.blk_height;
-    uint32_t blk_width=header.blk_width;
 
-    uint32_t img_height = header.img_height;
-    uint32_t img_width  = header.img_width;
+    if(header.ibpp > MAX_IBPP) {
+      std::cerr<<"Compressed image format not supported. Input bpp >"<<MAX_IBPP
+            <<"."<<std::endl;
+      std::cerr<<"Input bpp:"<< int(header.ibpp)<<std::endl;
+      throw 1;
+    }
 
-    int blk_rows=ceil(img_height/float(blk_height));
-    int blk_cols=ceil(img_width/float(blk_width));
+    if(get_coder_profile_api(header.coder_profile) == nullptr) {
+      std::cerr<<"Compressed image format not supported. Unknown coder profile: "
+            <<int(header.coder_profile)<<std::endl;
+      throw 1;
+    }
 
-    int chroma_mode = header.color_profile;
-    uint ee_buffer_size = 32 * (1<<header.ee_buffer_exp);
-    int fix_predictor = header.predictor;
-    int NEAR = (int)header.NEAR ;
+    if(header.ee_buffer_exp > EE_BUFFER_MAX_EXP) {
+      std::cerr<<"Compressed image format not supported. tANS chunk size exponent >"
+            <<EE_BUFFER_MAX_EXP<<"."<<std::endl;
+      throw 1;
+    }
+
+    if(verbose) {
+      std::cout<<" Encoded image configuration ";
+      std::cout<<"| NEAR: "<<int(header.NEAR); 
+      std::cout<<"| ibpp: "<<int(header.ibpp); 
+      std::cout<<"| blk_height: "<<header.blk_height; 
+      std::cout<<"| blk_width: "<<header.blk_width; 
+      std::cout<<"| img_height: "<<header.img_height; 
+      std::cout<<"| img_width: "<<header.img_width; 
+      if(header.get_num_ANS_states() > 1) {
+        std::cout<<"| ANS states: "<<header.get_num_ANS_states(); 
+      }
+      if(header.flags & GL_FLAG_STRIP_MODE) {
+        std::cout<<"| strip mode "; 
+      }
+      if(header.flags & GL_FLAG_IMAGE_TABLES) {
+        std::cout<<"| image tables "; 
+      }
+      if(header.get_ee_buffer_size() != EE_BUFFER_SIZE) {
+        std::cout<<"| chunk size: "<<header.get_ee_buffer_size(); 
+      }
+      if(header.coder_profile != CODER_PROFILE_DEFAULT) {
+        std::cout<<"| profile: "<<get_coder_profile_api(header.coder_profile)->name; 
+      }
+      std::cout<< std::endl;
+    }
 
-    std::cout<<" Encoded image configuration ";
-    std::cout<<"| NEAR: "<<NEAR; 
-    std::cout<<"| ibpp: "<<int(header.ibpp); 
-    std::cout<<"| blk_height: "<<blk_height; 
-    std::cout<<"| blk_width: "<<blk_width; 
-    std::cout<<"| img_height: "<<img_height; 
-    std::cout<<"| img_width: "<<img_width; 
-    std::cout<< std::endl;
+    tANS_tables.reset();
+    if(header.flags & GL_FLAG_IMAGE_TABLES) {
+      tANS_tables = load_image_tANS_tables(table_section,header.coder_profile);
+    }
 
     int num_of_channels;
-    switch(chroma_mode){
+    switch(header.color_profile){
       case CHROMA_MODE_YUV420 :
       case CHROMA_MODE_YUV422 :
       case CHROMA_MODE_YUV444 :
@@ -170,71 +473,382 @@ int decoder(char* in_file,cv::Mat &dst_img, bool scale_depth){
         std::cerr<<"Unknown chroma mode. Quitting"<<std::endl;
         throw 1;
     }
+    return num_of_channels;
+}
+
+static void create_out_image(const global_header &header,int rows, int cols,
+                                                        cv::Mat &dst_img){
+  int img_depth_type = header.ibpp > 8? CV_16U:CV_8U;
+  if (header.color_profile==CHROMA_MODE_GRAY){
+    dst_img=cv::Mat::zeros(rows,cols,CV_MAKETYPE(img_depth_type,1));
+  }else{
+    dst_img=cv::Mat::zeros(rows,cols,CV_MAKETYPE(img_depth_type,3));
+  }
+}
+
+static void scale_image_depth(const global_header &header,cv::Mat &dst_img,
+                                                      bool verbose = true){
+  if(header.ibpp !=8 && header.ibpp!=16) {
+    int bit_increase = header.ibpp<8? 8-header.ibpp:16-header.ibpp ;
+    if(verbose) {
+      std::cout<< "Scaling image depth up "<<bit_increase<<" bits"<<std::endl;
+    }
+    double scale_factor = pow(2,bit_increase);
+    dst_img.convertTo(dst_img,-1,scale_factor);
+  }
+}
+
+// Checks that the block type and size match the block (rows x cols pixels),
+// and that the binary fits in the block binary buffer
+static void check_block_header(const block_header &block_header, int rows, int cols,
+                                                    size_t max_block_data_size){
+  const bool valid = block_header.size <= max_block_data_size - DECODER_INPUT_PADDING &&
+   (block_header.type == BLOCK_TYPE_CODED || 
+    block_header.type == BLOCK_TYPE_STATIC ||
+    (block_header.type == BLOCK_TYPE_STORED && block_header.size == uint32_t(rows*cols)) ||
+    (block_header.type == BLOCK_TYPE_CONSTANT && block_header.size == 1));
+  if(!valid) {
+    std::cerr<<"Error: Invalid block header. Type: "<<int(block_header.type)
+              <<" | size: "<<block_header.size<<std::endl;
+    throw 1;
+  }
+}
+
+// Reads the block header at the current position of binary_in_file and checks
+// it (see check_block_header)
+static void read_block_header(std::ifstream &binary_in_file,const global_header &header,
+                  const cv::Mat &block, size_t max_block_data_size, 
+                  struct block_header &block_header){
+  if(!binary_in_file.read((char*)&(block_header),get_block_header_size(header))) {
+    std::cerr<<"Error: Unexpected end of compressed image file"<<std::endl;
+    throw 1;
+  }
+  check_block_header(block_header,block.rows,block.cols,max_block_data_size);
+}
+
+static void read_block_binary(std::ifstream &binary_in_file,
+              const struct block_header &block_header, char* block_binary_data){
+  if(!binary_in_file.read(block_binary_data, block_header.size)) {
+    std::cerr<<"Error: Unexpected end of compressed image file"<<std::endl;
+    throw 1;
+  }
+}
+
+// Reads the block at location and decodes it into block
+static void decode_block_at(std::ifstream &binary_in_file,const global_header &header,
+          const block_location &location, char* block_binary_data, 
+          size_t max_block_data_size, cv::Mat &block,
+          const tANS_coder_tables_t *tANS_tables, const strip_link_t *strip = nullptr){
+  struct block_header block_header;
+  binary_in_file.seekg(location.offset);
+  read_block_header(binary_in_file,header,block,max_block_data_size,block_header);
+  if(block_header.size != location.size) {
+    std::cerr<<"Error: Block header size ("<<block_header.size
+              <<") doesn't match the block index ("<<location.size<<")"<<std::endl;
+    throw 1;
+  }
+  read_block_binary(binary_in_file,block_header,block_binary_data);
+
+  char codec_mode= (header.color_profile==CHROMA_MODE_YUV420 && header.blk_height==1)? 1 : 0;
+  uint ee_buffer_size = header.get_ee_buffer_size();
+  decode_core((unsigned char*)block_binary_data,block,header.color_profile,
+              header.predictor, header.NEAR,ee_buffer_size,header.ibpp,codec_mode,
+              header.get_num_ANS_states(),strip,tANS_tables,block_header.type,
+              header.coder_profile);
+}
+
+// Decodes the first num_of_strips strips of a strip mode image into img.
+// Strips are decoded as a wavefront: a row of a strip is decoded once the 
+// same row of the left strip is done
+static void decode_strips(char* in_file,const global_header &header,
+            const std::vector<block_location> &block_locations, 
+            const tANS_coder_tables_t *tANS_tables,
+            cv::Mat &img, int num_of_strips, int num_of_channels, int threads){
+  const size_t max_block_data_size=get_max_block_data_size(header,num_of_channels);
+  std::vector<std::atomic<int>> rows_done(num_of_strips);
+  for(auto & strip_rows_done: rows_done) {
+    strip_rows_done.store(0);
+  }
+  bool decode_error = false;
+
+  // dynamic scheduling assigns the strips in order, so the left strip is 
+  // always being decoded by another thread (or already done)
+  #pragma omp parallel num_threads(threads) if(threads > 1)
+  {
+    std::ifstream thread_in_file(in_file, std::ios::binary );
+    char* thread_block_binary_data = new char[max_block_data_size];
+
+    #pragma omp for schedule(dynamic)
+    for(int strip_idx = 0; strip_idx < num_of_strips; ++strip_idx) {
+      const int col_low = strip_idx*header.blk_width;
+      const int col_high = std::min(col_low+int(header.blk_width),img.cols);
+      cv::Mat strip_block = img(cv::Range::all(),cv::Range(col_low,col_high));
+      strip_link_t strip;
+      strip.has_left_strip = strip_idx > 0;
+      strip.left_rows_done = strip_idx > 0? &rows_done[strip_idx-1] : nullptr;
+      strip.rows_done = &rows_done[strip_idx];
+      try{
+        decode_block_at(thread_in_file,header,block_locations[strip_idx],
+                      thread_block_binary_data,max_block_data_size,strip_block,
+                      tANS_tables,&strip);
+      }catch(...){
+        // exceptions can't leave the parallel region
+        #pragma omp atomic write
+        decode_error = true;
+        rows_done[strip_idx].store(img.rows); // release right strip
+      }
+    }
+
+    delete[] thread_block_binary_data;
+  }
+
+  if(decode_error) {
+    std::cerr<<DBG_INFO<<"Error decoding image blocks"<<std::endl;
+    throw 1;
+  }
+}
+
+int decoder(char* in_file,cv::Mat &dst_img, bool scale_depth, int threads,
+                                                                  bool verbose){
+  //open LOCO-ANS-coded image
+    std::ifstream binary_in_file(in_file, std::ios::binary );
+
+  //extract file header
+    struct global_header header;
+    std::shared_ptr<const tANS_coder_tables_t> tANS_tables;
+    int num_of_channels = read_and_check_header(binary_in_file,header,tANS_tables,
+                                                                      verbose);
+    
+    uint32_t blk_height=header.blk_height;
+    uint32_t blk_width=header.blk_width;
+
+    uint32_t img_height = header.img_height;
+    uint32_t img_width  = header.img_width;
+
+    int blk_rows=ceil(img_height/float(blk_height));
+    int blk_cols=ceil(img_width/float(blk_width));
+
+    int chroma_mode = header.color_profile;
+    uint ee_buffer_size = header.get_ee_buffer_size();
+    int fix_predictor = header.predictor;
+    int NEAR = (int)header.NEAR ;
 
   //variable initiation for decoder loop
-    char* block_binary_data;
-    // max_block_data_size has to be a bit bigger than actual max size to avoid
-    // segfaults due to how the binary is read (binary buffer will read an 
-    // additional word)
-    size_t max_block_data_size=(blk_height*blk_width*num_of_channels*
-                            (1+int(MAX_SUPPORTED_BPP/8)/sizeof(*block_binary_data))+8);
-    block_binary_data = new char[max_block_data_size];
+    size_t max_block_data_size=get_max_block_data_size(header,num_of_channels);
 
   //loop to decode every block
 
     //create out image object
-      if(header.ibpp > MAX_IBPP) {
-        std::cerr<<"Compressed image format not supported. Input bpp >"<<MAX_IBPP
-              <<"."<<std::endl;
-        std::cerr<<"Input bpp:"<< int(header.ibpp)<<std::endl;
-        throw 1;
-      }
-      int img_depth_type = header.ibpp > 8? CV_16U:CV_8U;
-      if (header.color_profile==CHROMA_MODE_GRAY){
-        dst_img=cv::Mat::zeros(img_height,img_width,CV_MAKETYPE(img_depth_type,1));
-      }else{
-        dst_img=cv::Mat::zeros(img_height,img_width,CV_MAKETYPE(img_depth_type,3));
-      }
+      create_out_image(header,img_height,img_width,dst_img);
     
-    cv::Mat block;
     char codec_mode= (chroma_mode==CHROMA_MODE_YUV420 && blk_height==1)? 1 : 0;
+
+    auto get_block = [&](int blk_row, int blk_col){
+      //map a range of full image to block (they share image data)
+      int row_low = blk_row*blk_height;
+      int row_high = MIN((blk_row+1)*blk_height,dst_img.rows);
+      int col_low = blk_col*blk_width;
+      int col_high = MIN((blk_col+1)*blk_width,dst_img.cols); 
+      return dst_img(cv::Range(row_low,row_high),cv::Range(col_low,col_high)); 
+    };
     
-    //omp_set_num_threads(threads);
-    for (uint16_t blk_row = 0; blk_row < blk_rows; ++blk_row) {
-    //#pragma omp parallel for
-
-      for (uint16_t blk_col = 0; blk_col < blk_cols; ++blk_col) {
-        //map a range of full image to block (they share image data)
-        int row_low = blk_row*blk_height;
-        int row_high = MIN((blk_row+1)*blk_height,dst_img.rows);
-        int col_low = blk_col*blk_width;
-        int col_high = MIN((blk_col+1)*blk_width,dst_img.cols); 
-        block=dst_img(cv::Range(row_low,row_high),cv::Range(col_low,col_high)); 
-
-        //get block id and length of the generated binary
-          struct block_header block_header;
-          binary_in_file.read((char*)&(block_header),sizeof(block_header));
+    if(threads <= 1) {
+      char* block_binary_data = new char[max_block_data_size];
+      cv::Mat block;
 
+      for (uint16_t blk_row = 0; blk_row < blk_rows; ++blk_row) {
+        for (uint16_t blk_col = 0; blk_col < blk_cols; ++blk_col) {
+          block=get_block(blk_row,blk_col);
 
-        //get binary
-          binary_in_file.read(block_binary_data, block_header.size);
-          decode_core((unsigned char*)block_binary_data,block,chroma_mode,
-                                    fix_predictor, NEAR,ee_buffer_size,header.ibpp
-                                    ,codec_mode);
-        
+          //get block id and length of the generated binary
+            struct block_header block_header;
+            read_block_header(binary_in_file,header,block,max_block_data_size,
+                                                                  block_header);
+
+          //left strip is already decoded, no need to sync
+            strip_link_t strip;
+            strip.has_left_strip = blk_col > 0;
+
+          //get binary
+            read_block_binary(binary_in_file,block_header,block_binary_data);
+            decode_core((unsigned char*)block_binary_data,block,chroma_mode,
+                                      fix_predictor, NEAR,ee_buffer_size,header.ibpp
+                                      ,codec_mode,header.get_num_ANS_states(),
+                                      (header.flags & GL_FLAG_STRIP_MODE)? &strip : nullptr,
+                                      tANS_tables.get(),block_header.type,
+                                      header.coder_profile);
+        }
+      }
+      delete[] block_binary_data;
+    }else{
+      // Block offsets are obtained from the block index or, if not present,
+      // scanning the block headers. Then, each thread reads and decodes its
+      // blocks directly into their dst_img sub-rectangle
+      const int num_of_blocks = blk_rows*blk_cols;
+      std::vector<block_location> block_locations;
+      if(!get_block_locations(binary_in_file,header,num_of_blocks,max_block_data_size,
+                                                              block_locations)) {
+        std::cerr<<"Error: Unexpected end of compressed image file"<<std::endl;
+        throw 1;
+      }
+      if(header.flags & GL_FLAG_STRIP_MODE) {
+        decode_strips(in_file,header,block_locations,tANS_tables.get(),dst_img,
+                                      num_of_blocks,num_of_channels,threads);
+        if(scale_depth) {
+          scale_image_depth(header,dst_img,verbose);
+        }
+        return 0;
+      }
+      bool decode_error = false;
+
+      #pragma omp parallel num_threads(threads)
+      {
+        std::ifstream thread_in_file(in_file, std::ios::binary );
+        char* thread_block_binary_data = new char[max_block_data_size];
+
+        #pragma omp for schedule(dynamic)
+        for(int blk_idx = 0; blk_idx < num_of_blocks; ++blk_idx) {
+          cv::Mat thread_block = get_block(blk_idx/blk_cols,blk_idx%blk_cols);
+          try{
+            decode_block_at(thread_in_file,header,block_locations[blk_idx],
+                          thread_block_binary_data,max_block_data_size,thread_block,
+                          tANS_tables.get());
+          }catch(...){
+            // exceptions can't leave the parallel region
+            #pragma omp atomic write
+            decode_error = true;
+          }
+        }
 
+        delete[] thread_block_binary_data;
+      }
 
+      if(decode_error) {
+        std::cerr<<DBG_INFO<<"Error decoding image blocks"<<std::endl;
+        throw 1;
       }
     }
 
 
-  if(scale_depth && header.ibpp !=8 && header.ibpp!=16) {
-    int bit_increase = header.ibpp<8? 8-header.ibpp:16-header.ibpp ;
-    std::cout<< "Scaling image depth up "<<bit_increase<<" bits"<<std::endl;
-    double scale_factor = pow(2,bit_increase);
-    dst_img.convertTo(dst_img,-1,scale_factor);
+  if(scale_depth) {
+    scale_image_depth(header,dst_img,verbose);
   }
-  delete[] block_binary_data;
   return 0;
 }
 
+
+int decode_region(char* in_file,cv::Mat &dst_img,int x, int y, int w, int h,
+                                    bool scale_depth, int threads, bool verbose){
+  //open LOCO-ANS-coded image
+    std::ifstream binary_in_file(in_file, std::ios::binary );
+
+  //extract file header
+    struct global_header header;
+    std::shared_ptr<const tANS_coder_tables_t> tANS_tables;
+    int num_of_channels = read_and_check_header(binary_in_file,header,tANS_tables,
+                                                                      verbose);
+
+    const int blk_height=header.blk_height;
+    const int blk_width=header.blk_width;
+    const int img_height = header.img_height;
+    const int img_width  = header.img_width;
+    const int blk_cols=ceil(img_width/float(blk_width));
+    const int blk_rows=ceil(img_height/float(blk_height));
+
+  //clip region to the image
+    const int row_low = std::max(y,0);
+    const int row_high = std::min(y+h,img_height);
+    const int col_low = std::max(x,0);
+    const int col_high = std::min(x+w,img_width);
+    if(row_low >= row_high || col_low >= col_high) {
+      std::cerr<<"Error: Region does not intersect the image"<<std::endl;
+      throw 1;
+    }
+
+  //get the blocks intersecting the region
+    const size_t max_block_data_size=get_max_block_data_size(header,num_of_channels);
+    std::vector<block_location> block_locations;
+    if(!get_block_locations(binary_in_file,header,blk_rows*blk_cols,max_block_data_size,
+                                                              block_locations)) {
+      std::cerr<<"Error: Unexpected end of compressed image file"<<std::endl;
+      throw 1;
+    }
+
+    // strips depend on their left strip, so every strip up to the last one 
+    // intersecting the region is decoded
+    if(header.flags & GL_FLAG_STRIP_MODE) {
+      const int num_of_strips = (col_high-1)/blk_width + 1;
+      cv::Mat strips_img;
+      create_out_image(header,img_height,std::min(num_of_strips*blk_width,img_width),
+                                                                      strips_img);
+      decode_strips(in_file,header,block_locations,tANS_tables.get(),strips_img,
+                                          num_of_strips,num_of_channels,threads);
+      strips_img(cv::Range(row_low,row_high),cv::Range(col_low,col_high)).copyTo(dst_img);
+      if(scale_depth) {
+        scale_image_depth(header,dst_img,verbose);
+      }
+      return 0;
+    }
+
+    std::vector<int> region_blocks;
+    for(int blk_row = row_low/blk_height; blk_row <= (row_high-1)/blk_height; ++blk_row) {
+      for(int blk_col = col_low/blk_width; blk_col <= (col_high-1)/blk_width; ++blk_col) {
+        region_blocks.push_back(blk_row*blk_cols + blk_col);
+      }
+    }
+
+  //decode blocks and copy their intersection with the region to dst_img
+    create_out_image(header,row_high-row_low,col_high-col_low,dst_img);
+    const int num_of_region_blocks = region_blocks.size();
+    bool decode_error = false;
+
+    #pragma omp parallel num_threads(threads) if(threads > 1)
+    {
+      std::ifstream thread_in_file(in_file, std::ios::binary );
+      char* thread_block_binary_data = new char[max_block_data_size];
+
+      #pragma omp for schedule(dynamic)
+      for(int i = 0; i < num_of_region_blocks; ++i) {
+        const int blk_row = region_blocks[i]/blk_cols;
+        const int blk_col = region_blocks[i]%blk_cols;
+        const int blk_row_low = blk_row*blk_height;
+        const int blk_row_high = std::min((blk_row+1)*blk_height,img_height);
+        const int blk_col_low = blk_col*blk_width;
+        const int blk_col_high = std::min((blk_col+1)*blk_width,img_width);
+        cv::Mat block(blk_row_high-blk_row_low,blk_col_high-blk_col_low,dst_img.type());
+        try{
+          decode_block_at(thread_in_file,header,block_locations[region_blocks[i]],
+                              thread_block_binary_data,max_block_data_size,block,
+                              tANS_tables.get());
+        }catch(...){
+          // exceptions can't leave the parallel region
+          #pragma omp atomic write
+          decode_error = true;
+          continue;
+        }
+
+        // intersection in image coordinates
+        const int i_row_low = std::max(row_low,blk_row_low);
+        const int i_row_high = std::min(row_high,blk_row_high);
+        const int i_col_low = std::max(col_low,blk_col_low);
+        const int i_col_high = std::min(col_high,blk_col_high);
+
+        cv::Mat dst_roi = dst_img(cv::Range(i_row_low-row_low,i_row_high-row_low),
+                                  cv::Range(i_col_low-col_low,i_col_high-col_low));
+        block(cv::Range(i_row_low-blk_row_low,i_row_high-blk_row_low),
+              cv::Range(i_col_low-blk_col_low,i_col_high-blk_col_low)).copyTo(dst_roi);
+      }
+
+      delete[] thread_block_binary_data;
+    }
+
+    if(decode_error) {
+      std::cerr<<DBG_INFO<<"Error decoding image blocks"<<std::endl;
+      throw 1;
+    }
+
+  if(scale_depth) {
+    scale_image_depth(header,dst_img,verbose);
+  }
+  return 0;
+}
@@ -29,17 +29,44 @@
 #include <stdint.h>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <cstddef> //offsetof
 
 
 const int MAX_NEAR = 255;
 
-#define GL_HEADER_VERSION (2)
+// Version 3 adds the flags field. As the version field is 2 bits wide, 
+// further format extensions have to be signaled using flags 
+#define GL_HEADER_VERSION (3)
+#define GL_HEADER_MIN_VERSION (2) // oldest supported version
+
+// global_header flags
+#define GL_FLAG_BLOCK_INDEX (0x01) // file ends with a block index footer
+#define GL_FLAG_ANS_STATES_SHIFT (1) // log2 of the interleaved tANS states
+#define GL_FLAG_ANS_STATES_MASK (0x03 << GL_FLAG_ANS_STATES_SHIFT)
+#define GL_FLAG_STRIP_MODE (0x08) // blocks are vertical strips (see strip_link_t)
+#define GL_FLAG_IMAGE_TABLES (0x10) // tANS table section after the header
+#define GL_FLAG_BLOCK_TYPES (0x20) // block headers have the block type
+#define GL_FLAG_CODER_PROFILE (0x40) // coder_profile field after the flags
+
+/* tANS table section (when GL_FLAG_IMAGE_TABLES is set):
+ * Tables tuned for the image in two-pass mode (see get_image_tANS_tables).
+ * It follows the global header: a uint16_t with the section size in bytes 
+ * and the section data. Blocks come after it.
+ */
+typedef uint16_t table_section_size_t;
+
+// tANS chunk size (symbols coded between ANS state flushes): 
+// EE_BUFFER_MIN_SIZE * 2^ee_buffer_exp
+#define EE_BUFFER_MIN_SIZE (32)
+#define EE_BUFFER_MAX_EXP (16)
+
 struct global_header {
   uint8_t predictor:2;
   uint8_t color_profile:4;
   uint8_t version:2 ;
 
-  uint8_t ee_buffer_exp; // buffer_size = 32* 2^ee_buffer_exp
+  uint8_t ee_buffer_exp; // buffer_size = EE_BUFFER_MIN_SIZE* 2^ee_buffer_exp
   uint8_t ibpp;
 
   uint8_t NEAR;
@@ -50,22 +77,109 @@ struct global_header {
   uint16_t img_height; // img height 
   uint16_t img_width; // img width 
 
-  global_header():version(GL_HEADER_VERSION){}
-  bool check_version(){ return version == GL_HEADER_VERSION;}
+  // version >= 3 fields
+  uint8_t flags;
+  // with GL_FLAG_CODER_PROFILE. Otherwise, it's CODER_PROFILE_DEFAULT
+  uint8_t coder_profile;
+
+  global_header():version(GL_HEADER_VERSION),flags(0),
+                                      coder_profile(CODER_PROFILE_DEFAULT){}
+  bool check_version(){ 
+    return GL_HEADER_MIN_VERSION <= version && version <= GL_HEADER_VERSION;}
+  size_t size() const { // size in file
+    if(version < 3) {
+      return offsetof(global_header,flags);
+    }
+    return (flags & GL_FLAG_CODER_PROFILE)? sizeof(global_header) : 
+                                            offsetof(global_header,coder_profile);
+  }
+
+  uint get_ee_buffer_size() const {
+    return EE_BUFFER_MIN_SIZE << ee_buffer_exp;}
+
+  int get_num_ANS_states() const {
+    return 1 << ((flags & GL_FLAG_ANS_STATES_MASK) >> GL_FLAG_ANS_STATES_SHIFT);}
+  void set_num_ANS_states(int num_ANS_states){
+    flags &= ~GL_FLAG_ANS_STATES_MASK;
+    flags |= (int(std::log2(num_ANS_states)) << GL_FLAG_ANS_STATES_SHIFT) & GL_FLAG_ANS_STATES_MASK;
+  }
 }__attribute__((packed));
 
 struct block_header {
   uint32_t size; //in bytes
+  uint8_t type; // BLOCK_TYPE_*. Only in the file with GL_FLAG_BLOCK_TYPES
+  block_header():size(0),type(BLOCK_TYPE_CODED){}
 }__attribute__((packed));
 
+// size of block_header in the file
+inline size_t get_block_header_size(const global_header &header){
+  return (header.flags & GL_FLAG_BLOCK_TYPES)? sizeof(block_header) : 
+                                                offsetof(block_header,type);
+}
+
+// Location of a block in the compressed file. It's also the entry of the 
+// block index
+struct block_location {
+  uint64_t offset; //in bytes, position of the block_header from file start
+  uint64_t size; //in bytes, binary size (excluding block_header)
+}__attribute__((packed));
+
+/* Block index footer (when GL_FLAG_BLOCK_INDEX is set):
+ * After the last block, a table with the block_location of every block is 
+ * stored (in raster order), followed by the block_index_trailer, which is
+ * at the end of the file. 
+ */
+#define BLOCK_INDEX_MAGIC (0x58444E49) // "INDX"
+struct block_index_trailer {
+  uint64_t index_offset; // position of the first block_location
+  uint32_t num_of_blocks;
+  uint32_t magic;
+}__attribute__((packed));
 
 
+
+// Returns the compressed image size (bytes), or -1 if the arguments are not
+// valid
 int encoder(const cv::Mat& src_img,char* out_file,int block_width=128,
                     int block_height=8, int chroma_samp=0 , char prediction = ENCODER_PRED_LOCO, 
                       int NEAR = 0,
                       char encoder_mode = ENCODER_MODE_ENCODE, 
-                      int ibpp=8);
-
-int decoder(char* in_file,cv::Mat &dst_img, bool scale_depth=false);
+                      int ibpp=8,
+                      int threads=1,
+                      bool add_block_index=true,
+                      bool pipelined=false,
+                      int num_ANS_states=1,
+                      bool strip_mode=false, // block_height is set to the image height
+                      bool two_pass=false, // tANS tables tuned for the image
+                      int ee_buffer_size=EE_BUFFER_SIZE, // symbols per tANS chunk
+                      bool static_model=false, // fixed context parameters per block
+                      int coder_profile=CODER_PROFILE_DEFAULT);
+
+// verbose: print the image configuration
+int decoder(char* in_file,cv::Mat &dst_img, bool scale_depth=false, int threads=1,
+                                                          bool verbose=true);
+
+// Decodes the region of w x h pixels with top left corner (x,y). Only the 
+// blocks intersecting the region are decoded. The region is clipped to the 
+// image and dst_img has the size of the clipped region. In strip mode, strips
+// depend on the strip to their left, so every strip up to the last one
+// intersecting the region is fully decoded (all rows).
+// Errors (ex: the region doesn't intersect the image) throw, like the ones of
+// decoder(). verbose: print the image configuration
+int decode_region(char* in_file,cv::Mat &dst_img,int x, int y, int w, int h,
+                      bool scale_depth=false, int threads=1, bool verbose=true);
+
+// Reads the global header, and the tANS table section if present (so the 
+// file position is the first block_header)
+bool read_global_header(std::ifstream &binary_in_file, global_header &header,
+                                    std::vector<uint8_t> &table_section);
+
+// Gets the location of the num_of_blocks blocks. It uses the block index if
+// present. Otherwise, it reads the block headers from the current position of
+// binary_in_file (which should be the first block_header). Blocks larger than
+// max_block_data_size (see get_max_block_data_size) are rejected
+bool get_block_locations(std::ifstream &binary_in_file,const global_header &header,
+            int num_of_blocks, size_t max_block_data_size,
+            std::vector<block_location> &block_locations);
 
 #endif /* CODEC_H */
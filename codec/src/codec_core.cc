@@ -24,20 +24,28 @@
 #include "context.h"
 #include "ANS_coder.h"
 
+namespace CODER_PROFILE_NS {
 
-int INPUT_BPP=8;
-int MAXVAL = pow(2,INPUT_BPP)-1;
-int EE_REMAINDER_SIZE =  (INPUT_BPP-1);
 
-void set_codec_parameters(int ibpp,int near){
-  INPUT_BPP=ibpp;
-  MAXVAL = (1 << ibpp) - 1;
+struct codec_params_t{
+  int INPUT_BPP;
+  int MAXVAL;
+  int EE_REMAINDER_SIZE;
+  int ALPHA; // number of quantized error values
+};
+
+codec_params_t get_codec_parameters(int ibpp,int near){
+  codec_params_t params;
+  params.INPUT_BPP=ibpp;
+  params.MAXVAL = (1 << ibpp) - 1;
   #if ERROR_REDUCTION
-    EE_REMAINDER_SIZE =  (INPUT_BPP-1);
+    params.EE_REMAINDER_SIZE =  (params.INPUT_BPP-1);
   #else
-    EE_REMAINDER_SIZE =  (INPUT_BPP);
+    params.EE_REMAINDER_SIZE =  (params.INPUT_BPP);
   #endif
-   
+  params.ALPHA = near ==0? params.MAXVAL + 1 :
+                       (params.MAXVAL + 2 * near) / (2*near +1) + 1;
+  return params;
 }
 
 
@@ -63,7 +71,10 @@ void set_codec_parameters(int ibpp,int near){
   }
 
   
-  inline void get_prediction_and_context(RowBuffer &row_buffer,int col, int MAXVAL,
+  // Context_model_t: Context_model or Static_context_model
+  template <class Context_model_t>
+  inline void get_prediction_and_context(const Context_model_t &ctx_model,
+                                RowBuffer &row_buffer,int col, int MAXVAL,
                                 Context_t &context,int &prediction ){
     #if ADD_GRAD_4
       int a,b,c,d,e;
@@ -91,132 +102,458 @@ void set_codec_parameters(int ibpp,int near){
     #endif
 
     //correct prediction
-    prediction = clamp(get_context_bias(context) + fixed_prediction,MAXVAL);
+    prediction = clamp(ctx_model.get_context_bias(context) + fixed_prediction,MAXVAL);
+  }
+
+  // Same as get_prediction_and_context, but taking the previous row part of 
+  // the context from row_ctx (see Row contexts in context.h), and the 
+  // template from the rows prev and curr (pointing to column 0), which need
+  // extra_cols_before valid columns before col (RowBuffer rows or 
+  // LosslessRowView rows and windows)
+  template <class Context_model_t>
+  inline void get_prediction_and_context(const Context_model_t &ctx_model,
+                                const uchar *prev, const uchar *curr,int col, 
+                                int MAXVAL,int row_ctx, Context_t &context,
+                                int &prediction ){
+    const int a = curr[col-1];
+    const int b = prev[col];
+    const int c = prev[col-1];
+
+    // compute fix prediction
+    int dy = c - a;
+    int dx = b - c;
+    int dxy = b - a ;
+    int s = (dy ^ dx)>>(sizeof(s)*8-1) ;
+    dxy &= (dy ^ dxy)>>(sizeof(dxy)*8-1) ;
+    int fixed_prediction = !s ? b - dy: a + dxy;
+
+    // get context
+    #if ADD_GRAD_4
+      context = map_row_context_to_int(row_ctx, dy,a-curr[col-2]);
+    #else
+      context = map_row_context_to_int(row_ctx, dy);
+    #endif
+
+    //correct prediction
+    prediction = clamp(ctx_model.get_context_bias(context) + fixed_prediction,MAXVAL);
+  }
+
+  /* Lossless encoder front end:
+   * In lossless mode the reconstructed values are the source ones, so the 
+   * fixed prediction and the context of every pixel of a row only depend on
+   * the source image. The encoder computes them for the row with 
+   * get_lossless_row_front_end, reading the source rows (see 
+   * LosslessRowView), so the serial loop only does the bias correction, the
+   * context update and the symbol coding.
+   * row_ctx gets the context id before the sign folding (see 
+   * map_gradients_to_int), row_pred the fixed prediction. prev_row and 
+   * curr_row point to column 0 of the rows.
+   */
+  typedef void (*lossless_row_fn_t)(const uchar *prev_row, 
+              const uchar *curr_row, int cols, int32_t *row_ctx, int32_t *row_pred);
+
+  static void lossless_row_front_end_scalar(const uchar *prev_row,
+              const uchar *curr_row, int cols, int32_t *row_ctx, int32_t *row_pred){
+    for(int col = 0; col < cols; ++col) {
+      const int a = curr_row[col-1];
+      const int b = prev_row[col];
+      const int c = prev_row[col-1];
+      const int d = prev_row[col+1];
+
+      int dy = c - a;
+      int dx = b - c;
+      int dxy = b - a ;
+      int s = (dy ^ dx)>>(sizeof(s)*8-1) ;
+      dxy &= (dy ^ dxy)>>(sizeof(dxy)*8-1) ;
+      row_pred[col] = !s ? b - dy: a + dxy;
+
+      int context_id = (*(gradient_quant+(d-b))*CTX_BINS_PER_DIM + 
+              *(gradient_quant+dx))*CTX_BINS_PER_DIM + *(gradient_quant+dy);
+      #if ADD_GRAD_4
+        const int e = curr_row[col-2];
+        context_id = context_id*3 + *(gradient4_quant+(a-e));
+      #endif
+      row_ctx[col] = context_id;
+    }
+  }
+
+  #if ROW_CONTEXTS_SIMD
+  __attribute__((target("avx2")))
+  static void lossless_row_front_end_avx2(const uchar *prev_row,
+              const uchar *curr_row, int cols, int32_t *row_ctx, int32_t *row_pred){
+    const __m256i bins_per_dim = _mm256_set1_epi32(CTX_BINS_PER_DIM);
+    int col = 0;
+    for(; col + 8 <= cols; col += 8) {
+      const __m256i a = load_px8_avx2(curr_row+col-1);
+      const __m256i b = load_px8_avx2(prev_row+col);
+      const __m256i c = load_px8_avx2(prev_row+col-1);
+      const __m256i d = load_px8_avx2(prev_row+col+1);
+
+      const __m256i dy = _mm256_sub_epi32(c,a);
+      const __m256i dx = _mm256_sub_epi32(b,c);
+      __m256i dxy = _mm256_sub_epi32(b,a);
+      const __m256i s = _mm256_srai_epi32(_mm256_xor_si256(dy,dx),31);
+      dxy = _mm256_and_si256(dxy,_mm256_srai_epi32(_mm256_xor_si256(dy,dxy),31));
+      const __m256i pred = _mm256_blendv_epi8(_mm256_sub_epi32(b,dy),
+                                              _mm256_add_epi32(a,dxy),s);
+
+      __m256i ctx = _mm256_add_epi32(_mm256_mullo_epi32(
+            gradient_quantizer_avx2(_mm256_sub_epi32(d,b)),bins_per_dim),
+            gradient_quantizer_avx2(dx));
+      ctx = _mm256_add_epi32(_mm256_mullo_epi32(ctx,bins_per_dim),
+                                              gradient_quantizer_avx2(dy));
+      #if ADD_GRAD_4
+        const __m256i e = load_px8_avx2(curr_row+col-2);
+        ctx = _mm256_add_epi32(_mm256_mullo_epi32(ctx,_mm256_set1_epi32(3)),
+                                    grad4_quant_avx2(_mm256_sub_epi32(a,e)));
+      #endif
+      _mm256_storeu_si256((__m256i*)(row_pred+col),pred);
+      _mm256_storeu_si256((__m256i*)(row_ctx+col),ctx);
+    }
+    lossless_row_front_end_scalar(prev_row+col,curr_row+col,cols-col,
+                                                  row_ctx+col,row_pred+col);
+  }
+
+  __attribute__((target("sse4.1")))
+  static void lossless_row_front_end_sse4(const uchar *prev_row,
+              const uchar *curr_row, int cols, int32_t *row_ctx, int32_t *row_pred){
+    const __m128i bins_per_dim = _mm_set1_epi32(CTX_BINS_PER_DIM);
+    int col = 0;
+    for(; col + 4 <= cols; col += 4) {
+      const __m128i a = load_px4_sse4(curr_row+col-1);
+      const __m128i b = load_px4_sse4(prev_row+col);
+      const __m128i c = load_px4_sse4(prev_row+col-1);
+      const __m128i d = load_px4_sse4(prev_row+col+1);
+
+      const __m128i dy = _mm_sub_epi32(c,a);
+      const __m128i dx = _mm_sub_epi32(b,c);
+      __m128i dxy = _mm_sub_epi32(b,a);
+      const __m128i s = _mm_srai_epi32(_mm_xor_si128(dy,dx),31);
+      dxy = _mm_and_si128(dxy,_mm_srai_epi32(_mm_xor_si128(dy,dxy),31));
+      const __m128i pred = _mm_blendv_epi8(_mm_sub_epi32(b,dy),
+                                              _mm_add_epi32(a,dxy),s);
+
+      __m128i ctx = _mm_add_epi32(_mm_mullo_epi32(
+            gradient_quantizer_sse4(_mm_sub_epi32(d,b)),bins_per_dim),
+            gradient_quantizer_sse4(dx));
+      ctx = _mm_add_epi32(_mm_mullo_epi32(ctx,bins_per_dim),
+                                              gradient_quantizer_sse4(dy));
+      #if ADD_GRAD_4
+        const __m128i e = load_px4_sse4(curr_row+col-2);
+        ctx = _mm_add_epi32(_mm_mullo_epi32(ctx,_mm_set1_epi32(3)),
+                                    grad4_quant_sse4(_mm_sub_epi32(a,e)));
+      #endif
+      _mm_storeu_si128((__m128i*)(row_pred+col),pred);
+      _mm_storeu_si128((__m128i*)(row_ctx+col),ctx);
+    }
+    lossless_row_front_end_scalar(prev_row+col,curr_row+col,cols-col,
+                                                  row_ctx+col,row_pred+col);
+  }
+  #endif
+
+  static lossless_row_fn_t select_lossless_row_fn(){
+    #if ROW_CONTEXTS_SIMD
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("avx2")) {
+        return lossless_row_front_end_avx2;
+      }
+      if(__builtin_cpu_supports("sse4.1")) {
+        return lossless_row_front_end_sse4;
+      }
+    #endif
+    return lossless_row_front_end_scalar;
+  }
+
+  static const lossless_row_fn_t lossless_row_front_end = select_lossless_row_fn();
+
+  // front end of the current row of rows: head and tail cols from the 
+  // windows, the rest from the image rows
+  inline void get_lossless_row_front_end(const LosslessRowView &rows,
+                                          int32_t *row_ctx, int32_t *row_pred){
+    lossless_row_front_end(rows.head_prev(),rows.head_curr(),rows.head_cols,
+                                                              row_ctx,row_pred);
+    lossless_row_front_end(rows.prev+rows.head_cols,rows.curr+rows.head_cols,
+              rows.tail_col-rows.head_cols,row_ctx+rows.head_cols,row_pred+rows.head_cols);
+    lossless_row_front_end(rows.tail_prev(),rows.tail_curr(),rows.cols-rows.tail_col,
+                                  row_ctx+rows.tail_col,row_pred+rows.tail_col);
+  }
+
+  // previous row part of the contexts (see Row contexts in context.h) of the
+  // current row of rows
+  inline void get_lossless_row_contexts(const LosslessRowView &rows, int32_t *row_ctx){
+    get_row_contexts(rows.head_prev(),rows.head_cols,row_ctx);
+    get_row_contexts(rows.prev+rows.head_cols,rows.tail_col-rows.head_cols,
+                                                        row_ctx+rows.head_cols);
+    get_row_contexts(rows.tail_prev(),rows.cols-rows.tail_col,row_ctx+rows.tail_col);
+  }
+
+  inline Context_t get_front_end_context(int context_id){
+    const int sign = context_id >> (sizeof(context_id)*8 - 1);
+    return Context_t(mult_by_sign(context_id, sign),sign);
+  }
+
+  // strip mode row hooks (see strip_link_t). img is the image (view) holding 
+  // the reconstructed values of the current block.
+  // strip_wait_left_row waits until the left strip has the row, and returns
+  // whether there's a left strip
+  inline bool strip_wait_left_row(const strip_link_t *strip, int row){
+    if(strip == nullptr || !strip->has_left_strip) {
+      return false;
+    }
+    if(strip->left_rows_done != nullptr) {
+      while(strip->left_rows_done->load(std::memory_order_acquire) <= row) {
+        std::this_thread::yield();
+      }
+    }
+    return true;
+  }
+
+  inline void strip_start_row(const strip_link_t *strip,RowBuffer &row_buffer,
+                                                const cv::Mat &img, int row){
+    if(strip_wait_left_row(strip,row)) {
+      row_buffer.start_row(img.ptr<uchar>(row));
+    }else{
+      row_buffer.start_row();
+    }
+  }
+
+  inline void strip_start_row(const strip_link_t *strip,LosslessRowView &rows,
+                                                const cv::Mat &img, int row){
+    rows.start_row(img,row,strip_wait_left_row(strip,row));
+  }
+
+  inline void strip_end_row(const strip_link_t *strip, int row){
+    if(strip != nullptr && strip->rows_done != nullptr) {
+      strip->rows_done->store(row+1,std::memory_order_release);
+    }
   }
+
 /*
 
 *##################   Encoder  ########################
 */
 
+  bool is_constant_block(const cv::Mat& src){
+    const uchar value = src.ptr<uchar>(0)[0];
+    for(int row = 0; row < src.rows; ++row) {
+      const uchar * const row_ptr = src.ptr<uchar>(row);
+      for(int col = 0; col < src.cols; ++col) {
+        if(row_ptr[col] != value) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
 
-
-  size_t image_scanner(const cv::Mat& src,uint8_t* binary_file,int near, int  &geometric_coder_iters, bool analysis_enabled = false){
+  // Fits the static model parameters to src in two passes: the first one 
+  // gets the context biases and the second one, the coder parameters.
+  // Contexts and predictions are computed from src (with the lossless encoder
+  // front end), which is exact in lossless mode and an approximation of the
+  // reconstructed values otherwise
+  void fit_static_context_model(const cv::Mat& src, int near, 
+                      const codec_params_t &params, const strip_link_t *strip,
+                      Static_context_model &ctx_model){
+    const int MAXVAL = params.MAXVAL;
     const int delta = 2*near +1;
-    const int alpha = near ==0?MAXVAL + 1 :
-                       (MAXVAL + 2 * near) / delta + 1;
     #if ERROR_REDUCTION
-    const int MIN_REDUCT_ERROR = -near;
-    const int MAX_REDUCT_ERROR =  MAXVAL + near;
-    const int DECO_RANGE = alpha * delta;     
+    const int alpha = params.ALPHA;
     const int MAX_ERROR =  std::ceil(alpha/2.0) -1;
     const int MIN_ERROR = -std::floor(alpha/2.0);
     #endif
-    const int remainder_reduct_bits = std::floor(std::log2(float(delta)));
 
-    
-    context_init( near, alpha);
-    Symbol_Coder symbol_coder(binary_file,EE_REMAINDER_SIZE);
+    std::vector<static_ctx_stats_t> stats(CTX_BINS);
+    std::vector<int32_t> row_ctx(src.cols), row_pred(src.cols);
+    const bool left_strip = strip != nullptr && strip->has_left_strip;
+    for(int pass = 0; pass < 2; ++pass) {
+      LosslessRowView rows(src.cols);
+      int init_col = 1;
+      for (int row = 0; row < src.rows; ++row){
+        rows.start_row(src,row,left_strip);
+        const uchar * const row_ptr =  rows.curr;
+        get_lossless_row_front_end(rows,row_ctx.data(),row_pred.data());
+        for (int col = init_col; col < src.cols; ++col){
+          int channel_value = row_ptr[col];
+          const Context_t context = get_front_end_context(row_ctx[col]);
+          int prediction = clamp(ctx_model.get_context_bias(context) + row_pred[col],MAXVAL);
+          int error = mult_by_sign(channel_value - prediction,context.sign);
+          static_ctx_stats_t &ctx_stats = stats[context.id];
+
+          if(pass == 0) {
+            ctx_stats.cnt++;
+            ctx_stats.acc += error;
+          }else{
+            if(near > 0) {
+              error = UQ(error, delta,near );
+            }
+            #if ERROR_REDUCTION
+              if(error < MIN_ERROR) {
+                error += alpha;
+              }else if(error > MAX_ERROR) {
+                error -= alpha;
+              }
+            #endif
+            if(error < 0) {
+              ctx_stats.neg++;
+              ctx_stats.z_acc += -error-1;
+              ctx_stats.inv_z_acc += -error;
+            }else if(error > 0) {
+              ctx_stats.pos++;
+              ctx_stats.z_acc += error;
+              ctx_stats.inv_z_acc += error-1;
+            }
+          }
+        }
+        init_col = 0;
+      }
 
-    RowBuffer row_buffer(src.cols);
-    
-    //analysis
-      theoretical_bits = 0;
-      theoretical_entropy = 0;
+      if(pass == 0) {
+        ctx_model.fit_bias(stats);
+      }else{
+        ctx_model.fit_coder_params(stats);
+      }
+    }
+  }
 
-    // store first px 
-    {
-      int channel_value = get_value(src,0,0); 
-      #if DEBUG
-        printf("First channel_value: %0X\n",channel_value );
-      #endif
-      symbol_coder.store_pixel(channel_value,INPUT_BPP);
-      #ifdef ANALYSIS_CODE
-        theoretical_bits +=INPUT_BPP;
-        theoretical_entropy +=INPUT_BPP;
-      #endif
-      row_buffer.update(channel_value,0);
+
+  /* Scanner kernels:
+   * The per-pixel loops of the encoder (image_scanner) and the decoder
+   * (binary_scanner) are templates on the input bit depth and, in the
+   * encoder, on whether the analysis is enabled. IBPP == 0 means that the bit
+   * depth is taken from params at run time; otherwise MAXVAL and the lossless
+   * error reduction range are compile time constants. There's a kernel for
+   * lossless and one for near-lossless coding, and image_scanner and
+   * binary_scanner pick the instantiation for the block (scan_dispatch).
+   */
+  template <int IBPP>
+  inline int kernel_maxval(const codec_params_t &params){
+    return IBPP != 0 ? (1 << IBPP) - 1 : params.MAXVAL;
+  }
+
+  // Calls kernel.template run<IBPP>() with IBPP = 8 (the common case) or
+  // 0 (any other bit depth)
+  template <class Kernel_t>
+  inline void scan_dispatch(const codec_params_t &params,Kernel_t &kernel){
+    if(params.INPUT_BPP == 8) {
+      kernel.template run<8>();
+    }else{
+      kernel.template run<0>();
     }
+  }
 
+  // lossless coding: same algorithm, with some simplifications given that
+  // near == 0, no division is required
+  template <int IBPP, bool ANALYSIS, class Symbol_Coder_t, class Context_model_t>
+  void lossless_scan_kernel(const cv::Mat& src,Symbol_Coder_t &symbol_coder,
+                  Context_model_t &ctx_model, const codec_params_t &params,
+                  const strip_link_t *strip){
+    const int MAXVAL = kernel_maxval<IBPP>(params);
+    #if ERROR_REDUCTION
+    const int MIN_ERROR = -((MAXVAL + 1) >> 1); // alpha = MAXVAL + 1
+    #endif
 
+    LosslessRowView rows(src.cols);
+    std::vector<int32_t> row_ctx(src.cols), row_pred(src.cols);
     int init_col = 1;
-    if(near == 0) { 
-      // lossless coding: same algorithm, with some simplifications given that
-      // near == 0, no division is required
-      for (int row = 0; row < src.rows; ++row){
-        row_buffer.start_row();
-        const uchar * const row_ptr =  src.ptr<uchar>(row);
-        for (int col = init_col; col < src.cols; ++col){
-          int channel_value = row_ptr[col];
-          int prediction;
-          Context_t context;
-          get_prediction_and_context(row_buffer,col, MAXVAL,context,prediction);
+    for (int row = 0; row < src.rows; ++row){
+      strip_start_row(strip,rows,src,row); // lossless: src == decoded img
+      const uchar * const row_ptr =  rows.curr;
+      get_lossless_row_front_end(rows,row_ctx.data(),row_pred.data());
+      for (int col = init_col; col < src.cols; ++col){
+        int channel_value = row_ptr[col];
+        const Context_t context = get_front_end_context(row_ctx[col]);
+        int prediction = clamp(ctx_model.get_context_bias(context) + row_pred[col],MAXVAL);
 
-          int error = channel_value - prediction;
-          
-          int acc_inv_sign = (ctx_acc[context.id] > 0)? -1:0;
-          error = mult_by_sign(error,context.sign^acc_inv_sign);
+        int error = channel_value - prediction;
 
-          #if ERROR_REDUCTION
-            error -= MIN_ERROR;
-            error &= MAXVAL;
-            error += MIN_ERROR;
-          #endif
+        int acc_inv_sign = ctx_model.get_context_inv_sign(context);
+        error = mult_by_sign(error,context.sign^acc_inv_sign);
+
+        #if ERROR_REDUCTION
+          error -= MIN_ERROR;
+          error &= MAXVAL;
+          error += MIN_ERROR;
+        #endif
+
+        ee_symb_data symbol;
+          symbol.y = error <0? 1:0;
+          symbol.z = abs(error)-symbol.y;
+          symbol.theta_id = ctx_model.get_context_theta_idx(context);
+          symbol.p_id = ctx_model.get_context_p_idx(context);
+          symbol.remainder_reduct_bits = 0; // delta == 1
 
-          ee_symb_data symbol;
-            symbol.y = error <0? 1:0;
-            symbol.z = abs(error)-symbol.y;
-            symbol.theta_id = get_context_theta_idx(context);
-            symbol.p_id = ctx_p_idx[context.id];
-            symbol.remainder_reduct_bits = remainder_reduct_bits;
+        // get decoded value
+        int q_error =  mult_by_sign(error,acc_inv_sign);
 
-          // get decoded value
-          int q_error =  mult_by_sign(error,acc_inv_sign); 
-          int q_channel_value = channel_value; // given that we are in lossless
+        //update context
+        ctx_model.update_context(context, q_error,symbol.z,symbol.y);
 
-          //update context
-          row_buffer.update(q_channel_value,col);
-          update_context(context, q_error,symbol.z,symbol.y);
-      
-          // entropy encoding
-          symbol_coder.push_symbol(symbol);
+        // entropy encoding
+        symbol_coder.push_symbol(symbol);
 
-          #ifdef ANALYSIS_CODE
-            if(unlikely(analysis_enabled)) {
-              estimate_entropy(symbol,context,near);
-              estimate_code_length(symbol,context);
-            }
-          #endif
-        }
-        init_col = 0;
-        row_buffer.end_row();
-      }
-    }else{
-      #if USING_DIV_RED_LUT
-      int16_t _div_reduct_lut[511];
-      int16_t *div_reduct_lut = _div_reduct_lut+255;
-      //init lut
-        for(int error = -255; error <= 255; ++error) {
-          int qerror = UQ(error, delta,near );
-          if(unlikely(qerror < MIN_ERROR)){
-            qerror += alpha;
-          }else if(unlikely(qerror > MAX_ERROR)){
-            qerror -= alpha;
+        #ifdef ANALYSIS_CODE
+          if(ANALYSIS) {
+            estimate_entropy(symbol,context,0,ctx_model);
+            estimate_code_length(symbol,context,ctx_model);
           }
-          *(div_reduct_lut+error) = qerror;
+        #endif
+      }
+      init_col = 0;
+      strip_end_row(strip,row);
+    }
+  }
+
+  // In strip mode, quant_img is the reconstructed image view of the block
+  template <int IBPP, bool ANALYSIS, class Symbol_Coder_t, class Context_model_t>
+  void near_lossless_scan_kernel(const cv::Mat& src,Symbol_Coder_t &symbol_coder,
+                  Context_model_t &ctx_model, int near, const codec_params_t &params,
+                  const strip_link_t *strip, cv::Mat *quant_img){
+    const int MAXVAL = kernel_maxval<IBPP>(params);
+    const int delta = 2*near +1;
+    const int alpha = params.ALPHA;
+    #if ERROR_REDUCTION
+    const int MIN_REDUCT_ERROR = -near;
+    const int MAX_REDUCT_ERROR =  MAXVAL + near;
+    const int DECO_RANGE = alpha * delta;
+    const int MAX_ERROR =  std::ceil(alpha/2.0) -1;
+    const int MIN_ERROR = -std::floor(alpha/2.0);
+    #endif
+    const int remainder_reduct_bits = std::floor(std::log2(float(delta)));
+
+    #if USING_DIV_RED_LUT
+    int16_t _div_reduct_lut[511];
+    int16_t *div_reduct_lut = _div_reduct_lut+255;
+    //init lut
+      for(int error = -255; error <= 255; ++error) {
+        int qerror = UQ(error, delta,near );
+        if(unlikely(qerror < MIN_ERROR)){
+          qerror += alpha;
+        }else if(unlikely(qerror > MAX_ERROR)){
+          qerror -= alpha;
         }
-      #endif
+        *(div_reduct_lut+error) = qerror;
+      }
+    #endif
 
-      for (int row = 0; row < src.rows; ++row){
-      row_buffer.start_row();
+    RowBuffer row_buffer(src.cols);
+    row_buffer.update(get_value(src,0,0),0); // first px is stored as is
+
+    int init_col = 1;
+    for (int row = 0; row < src.rows; ++row){
+      if(strip != nullptr) {
+        strip_start_row(strip,row_buffer,*quant_img,row);
+      }else{
+        row_buffer.start_row();
+      }
       const uchar * const row_ptr =  src.ptr<uchar>(row);
       for (int col = init_col; col < src.cols; ++col){
         int channel_value = row_ptr[col];
         int prediction;
         Context_t context;
-        get_prediction_and_context(row_buffer,col, MAXVAL,context,prediction);
-        
+        get_prediction_and_context(ctx_model,row_buffer,col, MAXVAL,context,prediction);
+
         int error = channel_value - prediction;
-        int acc_inv_sign = (ctx_acc[context.id] > 0)? -1:0;
+        int acc_inv_sign = ctx_model.get_context_inv_sign(context);
         error = mult_by_sign(error,context.sign^acc_inv_sign);
 
         #if USING_DIV_RED_LUT
@@ -235,13 +572,13 @@ void set_codec_parameters(int ibpp,int near){
         ee_symb_data symbol;
           symbol.y = error <0? 1:0;
           symbol.z = abs(error)-symbol.y;
-          symbol.theta_id = get_context_theta_idx(context);
-          symbol.p_id = ctx_p_idx[context.id];
+          symbol.theta_id = ctx_model.get_context_theta_idx(context);
+          symbol.p_id = ctx_model.get_context_p_idx(context);
           symbol.remainder_reduct_bits = remainder_reduct_bits;
-        
+
 
         // get decoded value
-        int q_error = mult_by_sign(delta*error,acc_inv_sign); 
+        int q_error = mult_by_sign(delta*error,acc_inv_sign);
         int q_channel_value = (prediction + mult_by_sign(q_error,context.sign));
 
         #if ERROR_REDUCTION
@@ -250,29 +587,97 @@ void set_codec_parameters(int ibpp,int near){
           }else if(unlikely(q_channel_value > MAX_REDUCT_ERROR)){
             q_channel_value -= DECO_RANGE;
           }
-        #endif 
+        #endif
 
         //update context
         q_channel_value = clamp(q_channel_value,MAXVAL);
         assert(abs(q_channel_value-channel_value)<=near);
 
         row_buffer.update(q_channel_value,col);
-        update_context(context, q_error,symbol.z,symbol.y);
+        ctx_model.update_context(context, q_error,symbol.z,symbol.y);
 
 
         // entropy encoding
           #ifdef ANALYSIS_CODE
-          if(unlikely(analysis_enabled)) {
-            estimate_entropy(symbol,context,near);
-            estimate_code_length(symbol,context);
+          if(ANALYSIS) {
+            estimate_entropy(symbol,context,near,ctx_model);
+            estimate_code_length(symbol,context,ctx_model);
           }
           #endif
-    
+
         symbol_coder.push_symbol(symbol);
       }
       init_col = 0;
       row_buffer.end_row();
+      if(strip != nullptr) {
+        row_buffer.copy_prev_row(quant_img->ptr<uchar>(row));
+        strip_end_row(strip,row);
+      }
+    }
+  }
+
+  template <bool ANALYSIS, class Symbol_Coder_t, class Context_model_t>
+  struct encoder_scan_kernel_t{
+    const cv::Mat& src;
+    Symbol_Coder_t &symbol_coder;
+    Context_model_t &ctx_model;
+    int near;
+    const codec_params_t &params;
+    const strip_link_t *strip;
+    cv::Mat *quant_img;
+
+    template <int IBPP>
+    void run(){
+      if(near == 0) {
+        lossless_scan_kernel<IBPP,ANALYSIS>(src,symbol_coder,ctx_model,params,
+                                                                        strip);
+      }else{
+        near_lossless_scan_kernel<IBPP,ANALYSIS>(src,symbol_coder,ctx_model,near,
+                                                          params,strip,quant_img);
+      }
     }
+  };
+
+  // Symbol_Coder_t: Symbol_Coder, Pipelined_Symbol_Coder or Symbol_Counter
+  // Context_model_t: Context_model or Static_context_model
+  // In strip mode with near > 0, quant_img is the reconstructed image view of
+  // the block
+  template <class Symbol_Coder_t, class Context_model_t>
+  size_t image_scanner(const cv::Mat& src,Symbol_Coder_t &symbol_coder,
+                  Context_model_t &ctx_model, int near,
+                  const codec_params_t &params, int  &geometric_coder_iters,
+                  bool analysis_enabled = false,
+                  const strip_link_t *strip = nullptr, cv::Mat *quant_img = nullptr){
+    const int INPUT_BPP = params.INPUT_BPP;
+
+    //analysis
+      theoretical_bits = 0;
+      theoretical_entropy = 0;
+
+    // store first px
+    {
+      int channel_value = get_value(src,0,0);
+      #if DEBUG
+        printf("First channel_value: %0X\n",channel_value );
+      #endif
+      symbol_coder.store_pixel(channel_value,INPUT_BPP);
+      #ifdef ANALYSIS_CODE
+        theoretical_bits +=INPUT_BPP;
+        theoretical_entropy +=INPUT_BPP;
+      #endif
+    }
+
+    #ifdef ANALYSIS_CODE
+    if(unlikely(analysis_enabled)) {
+      encoder_scan_kernel_t<true,Symbol_Coder_t,Context_model_t> kernel{src,
+                symbol_coder,ctx_model,near,params,strip,quant_img};
+      scan_dispatch(params,kernel);
+    }else
+    #endif
+    {
+      encoder_scan_kernel_t<false,Symbol_Coder_t,Context_model_t> kernel{src,
+                symbol_coder,ctx_model,near,params,strip,quant_img};
+      scan_dispatch(params,kernel);
     }
 
     symbol_coder.code_symbol_buffer(); // encode and insert contents of buffers in file
@@ -280,11 +685,34 @@ void set_codec_parameters(int ibpp,int near){
     return symbol_coder.get_out_file_size();
   }
 
+  // Codes src into binary_file with the pipelined or the serial symbol coder
+  template <class Context_model_t>
+  size_t code_block(const cv::Mat& src,uint8_t* binary_file,Context_model_t &ctx_model,
+                  int near, const codec_params_t &params, bool pipelined, 
+                  int num_ANS_states, const tANS_coder_tables_t *tables, 
+                  uint ee_buffer_size, int &geometric_coder_iters, 
+                  bool analysis_enabled, const strip_link_t *strip, cv::Mat *quant_img){
+    if(pipelined) {
+      Pipelined_Symbol_Coder symbol_coder(binary_file,params.EE_REMAINDER_SIZE,
+                                      num_ANS_states,tables,ee_buffer_size);
+      return image_scanner(src,symbol_coder,ctx_model,near,params, 
+                              geometric_coder_iters,analysis_enabled,strip,quant_img);
+    }else{
+      Symbol_Coder symbol_coder(binary_file,params.EE_REMAINDER_SIZE,
+                                      num_ANS_states,tables,ee_buffer_size);
+      return image_scanner(src,symbol_coder,ctx_model,near,params, 
+                              geometric_coder_iters,analysis_enabled,strip,quant_img);
+    }
+  }
+
 
 
   uint32_t encode_core(const cv::Mat& src,cv::Mat & quant_img,uint8_t* binary_file, char chroma_mode,
-    char _fixed_prediction_alg, int near, char encoder_mode,int ibpp){
+    char _fixed_prediction_alg, int near, char encoder_mode,int ibpp, bool pipelined,
+    int num_ANS_states, const strip_link_t *strip, const ::tANS_coder_tables_t *profile_tables,
+    uint ee_buffer_size, uint8_t *block_type, bool static_model){
     // param setting and init
+      const tANS_coder_tables_t *tables = static_cast<const tANS_coder_tables_t*>(profile_tables);
 
       if(chroma_mode != CHROMA_MODE_GRAY) {
         std::cerr<< "chroma_mode != CHROMA_MODE_GRAY.";
@@ -303,12 +731,12 @@ void set_codec_parameters(int ibpp,int near){
       }
 
       #ifdef DEBUG
-      if((get_num_of_symbs(src.rows,src.cols,chroma_mode) % EE_BUFFER_SIZE) != 0) {
+      if((get_num_of_symbs(src.rows,src.cols,chroma_mode) % ee_buffer_size) != 0) {
         std::cerr<<"Warning: possible codification inefficiency due to codification block misalign \n";
       }
       #endif
 
-      set_codec_parameters(ibpp,near);
+      const codec_params_t params = get_codec_parameters(ibpp,near);
 
 
     //encode
@@ -317,10 +745,46 @@ void set_codec_parameters(int ibpp,int near){
         throw 1;
       }
 
+      const bool use_block_types = block_type != nullptr && (strip == nullptr || near == 0);
+      if(block_type != nullptr) {
+        *block_type = BLOCK_TYPE_CODED;
+      }
+      if(use_block_types && is_constant_block(src)) {
+        binary_file[0] = src.ptr<uchar>(0)[0];
+        strip_end_row(strip,src.rows-1);
+        *block_type = BLOCK_TYPE_CONSTANT;
+        return 1;
+      }
+
       bool analysis_enabled = (encoder_mode !=0) ;
       int geometric_coder_iters;
 
-      uint32_t file_size = image_scanner(src,binary_file,near, geometric_coder_iters,analysis_enabled);
+      uint32_t file_size;
+      if(static_model && block_type != nullptr) {
+        Static_context_model ctx_model(near,params.ALPHA);
+        fit_static_context_model(src,near,params,strip,ctx_model);
+        const size_t model_size = ctx_model.write(binary_file);
+        file_size = model_size + code_block(src,binary_file+model_size,ctx_model,
+                                near,params,pipelined,num_ANS_states,tables,
+                                ee_buffer_size,geometric_coder_iters,
+                                analysis_enabled,strip,&quant_img);
+        *block_type = BLOCK_TYPE_STATIC;
+      }else{
+        Context_model ctx_model(near,params.ALPHA);
+        file_size = code_block(src,binary_file,ctx_model,near,params,pipelined,
+                                num_ANS_states,tables,ee_buffer_size,
+                                geometric_coder_iters,analysis_enabled,
+                                strip,&quant_img);
+      }
+
+      const uint32_t stored_size = src.rows*src.cols; // ibpp <= 8
+      if(use_block_types && file_size >= stored_size) {
+        for(int row = 0; row < src.rows; ++row) {
+          memcpy(binary_file + row*src.cols,src.ptr<uchar>(row),src.cols);
+        }
+        *block_type = BLOCK_TYPE_STORED;
+        file_size = stored_size;
+      }
 
     #if DEBUG
       if(WARN_MAX_ST_IDX_cnt >0) {
@@ -344,122 +808,220 @@ void set_codec_parameters(int ibpp,int near){
   }
 
 
+  std::shared_ptr<const ::tANS_coder_tables_t> get_image_tANS_tables(const cv::Mat& src, 
+                        int near, int ibpp, std::vector<uint8_t> &table_section,
+                        bool static_model){
+    const codec_params_t params = get_codec_parameters(ibpp,near);
+    tANS_symbol_stats_t stats;
+    Symbol_Counter symbol_counter(stats);
+    int geometric_coder_iters;
+    if(static_model) {
+      Static_context_model ctx_model(near,params.ALPHA);
+      fit_static_context_model(src,near,params,nullptr,ctx_model);
+      image_scanner(src,symbol_counter,ctx_model,near,params,geometric_coder_iters);
+    }else{
+      Context_model ctx_model(near,params.ALPHA);
+      image_scanner(src,symbol_counter,ctx_model,near,params,geometric_coder_iters);
+    }
+
+    return std::shared_ptr<const tANS_coder_tables_t>(
+                  build_image_tANS_tables(stats,table_section),free_tANS_coder_tables);
+  }
+
+  std::shared_ptr<const ::tANS_coder_tables_t> load_image_tANS_tables(
+                                    const std::vector<uint8_t> &table_section){
+    return std::shared_ptr<const tANS_coder_tables_t>(
+        read_image_tANS_tables(table_section.data(),table_section.size()),
+                                                          free_tANS_coder_tables);
+  }
+
+
 /*
 *##################   Decoder  ########################
 */
 
-  void binary_scanner(unsigned char* block_binary,cv::Mat& decoded_img,int near){
-    //set run parameters
-      const int delta = 2*near +1;
-      const int alpha = near ==0? MAXVAL + 1 :
-                       (MAXVAL + 2 * near) / delta + 1;
-      const uint bit_reduction = std::floor(std::log2(delta));
-      const uint escape_bits = EE_REMAINDER_SIZE - bit_reduction; 
+  // decodes the lossless px at col, with the template read from prev and curr
+  // (see get_prediction_and_context)
+  template <class Context_model_t>
+  inline int decode_lossless_px(Binary_Decoder &bin_decoder,
+                        Context_model_t &ctx_model, int MAXVAL, uint escape_bits,
+                        const uchar *prev, const uchar *curr, int col, int row_ctx){
+    int prediction;
+    Context_t context;
+    get_prediction_and_context(ctx_model,prev,curr,col, MAXVAL,row_ctx,
+                                                        context,prediction);
+
+     // entropy decoding
+    int z,y,q_error;
+    bin_decoder.retrive_TSG_symbol(ctx_model.get_context_theta_idx(context),
+                        ctx_model.get_context_p_idx(context),escape_bits,z,y);
+
+    int error = y ==1? -z -1:z;
+    q_error = error;
+    q_error = ctx_model.get_context_inv_sign(context)?-q_error:q_error;
+    int deco_val = (prediction + mult_by_sign(q_error,context.sign));
 
-      #if ERROR_REDUCTION
-        const int DECO_RANGE = alpha * delta;
-        const int MIN_REDUCT_ERROR = -near;
-        const int MAX_REDUCT_ERROR =  MAXVAL + near;
-      #endif 
+    #if ERROR_REDUCTION
+      deco_val &= MAXVAL;
+    #endif
 
-    int num_of_symbols = get_num_of_symbs(decoded_img.rows,decoded_img.cols,CHROMA_MODE_GRAY);
-    Binary_Decoder bin_decoder(block_binary,num_of_symbols);
-    RowBuffer row_buffer(decoded_img.cols);
+    ctx_model.update_context(context, q_error,z,y);
+    return deco_val;
+  }
 
-    //variable init 
-      context_init( near, alpha);
+  // the decoded pixels are only stored in the output image, which the 
+  // template is read from (see LosslessRowView)
+  template <int IBPP, class Context_model_t>
+  void lossless_decode_kernel(Binary_Decoder &bin_decoder,cv::Mat& decoded_img,
+                        Context_model_t &ctx_model, const codec_params_t &params,
+                        const strip_link_t *strip){
+    const int MAXVAL = kernel_maxval<IBPP>(params);
+    const uint escape_bits = params.EE_REMAINDER_SIZE; // delta == 1
+
+    LosslessRowView rows(decoded_img.cols);
+    std::vector<int32_t> row_ctx(decoded_img.cols);
+    int init_col = 1;
+    for (int row = 0; row < decoded_img.rows; ++row){
+      strip_start_row(strip,rows,decoded_img,row);
+      // row prologue: previous row part of the contexts
+      get_lossless_row_contexts(rows,row_ctx.data());
+      uchar * const row_ptr =  decoded_img.ptr<uchar>(row);
+
+      // head cols: the template is in the windows
+      uchar * const head_curr = rows.head_curr();
+      for (int col = init_col; col < rows.head_cols; ++col){
+        const int q_channel_value = decode_lossless_px(bin_decoder,ctx_model,
+              MAXVAL,escape_bits,rows.head_prev(),head_curr,col,row_ctx[col]);
+        head_curr[col] = q_channel_value;
+        row_ptr[col] = q_channel_value;
+      }
 
-    {
-      int channel_value = bin_decoder.retrive_pixel(INPUT_BPP);
-      row_buffer.update(channel_value,0);
-      #if DEBUG
-        printf("First channel_value: %0X\n",channel_value );
-      #endif
-      set_value(decoded_img,0,0,channel_value);
+      for (int col = rows.head_cols; col < decoded_img.cols; ++col){
+        row_ptr[col] = decode_lossless_px(bin_decoder,ctx_model,MAXVAL,
+                                  escape_bits,rows.prev,row_ptr,col,row_ctx[col]);
+      }
+
+      strip_end_row(strip,row);
+      init_col= 0;
     }
+  }
+
+  template <int IBPP, class Context_model_t>
+  void near_lossless_decode_kernel(Binary_Decoder &bin_decoder,cv::Mat& decoded_img,
+                        Context_model_t &ctx_model, int near,
+                        const codec_params_t &params, const strip_link_t *strip){
+    const int MAXVAL = kernel_maxval<IBPP>(params);
+    const int delta = 2*near +1;
+    const uint bit_reduction = std::floor(std::log2(delta));
+    const uint escape_bits = params.EE_REMAINDER_SIZE - bit_reduction;
+
+    #if ERROR_REDUCTION
+      const int DECO_RANGE = params.ALPHA * delta;
+      const int MIN_REDUCT_ERROR = -near;
+      const int MAX_REDUCT_ERROR =  MAXVAL + near;
+    #endif
+
+    RowBuffer row_buffer(decoded_img.cols);
+    row_buffer.update(get_value(decoded_img,0,0),0); // first px
 
+    std::vector<int32_t> row_ctx(decoded_img.cols);
     int init_col = 1;
-    if(near == 0) {
-      for (int row = 0; row < decoded_img.rows; ++row){
-        row_buffer.start_row();
-        uchar * const row_ptr =  decoded_img.ptr<uchar>(row);
-        for (int col = init_col; col < decoded_img.cols; ++col){
-          
-          int prediction;
-          Context_t context;
-          get_prediction_and_context(row_buffer,col, MAXVAL,context,prediction);
-
-           // entropy decoding
-          int z,y,q_error;
-          bin_decoder.retrive_TSG_symbol(get_context_theta_idx(context),ctx_p_idx[context.id],escape_bits,z,y);
-
-          int error = y ==1? -z -1:z;
-          q_error = error;
-          q_error = (ctx_acc[context.id] > 0)?-q_error:q_error;
-          int deco_val = (prediction + mult_by_sign(q_error,context.sign));
-        
-          #if ERROR_REDUCTION 
-            deco_val &= MAXVAL;
-          #endif 
-
-          int q_channel_value = deco_val;
-          row_buffer.update(q_channel_value,col);
-          update_context(context, q_error,z,y);
-          
-          // store in output image
-          row_ptr[col] = q_channel_value;
-        }
+    for (int row = 0; row < decoded_img.rows; ++row){
+      // row prologue: previous row part of the contexts
+      get_row_contexts(row_buffer.prev_row+col_idx_off,decoded_img.cols,row_ctx.data());
+      strip_start_row(strip,row_buffer,decoded_img,row);
+      uchar * const row_ptr =  decoded_img.ptr<uchar>(row);
+      for (int col = init_col; col < decoded_img.cols; ++col){
+
+        int prediction;
+        Context_t context;
+        get_prediction_and_context(ctx_model,row_buffer.prev_row+col_idx_off,
+                        row_buffer.current_row+col_idx_off,col, MAXVAL,row_ctx[col],
+                                                            context,prediction);
+
+         // entropy decoding
+        int z,y,q_error;
+        bin_decoder.retrive_TSG_symbol(ctx_model.get_context_theta_idx(context),
+                            ctx_model.get_context_p_idx(context),escape_bits,z,y);
+
+        int error = y ==1? -z -1:z;
+        q_error = error*delta;
+        q_error = ctx_model.get_context_inv_sign(context)?-q_error:q_error;
+        int deco_val = (prediction + mult_by_sign(q_error,context.sign));
+
+        #if ERROR_REDUCTION
+          if(unlikely(deco_val < MIN_REDUCT_ERROR)){
+            deco_val += DECO_RANGE;
+          }else if(unlikely(deco_val > MAX_REDUCT_ERROR)){
+            deco_val -= DECO_RANGE;
+          }
+        #endif
+
+        int q_channel_value = clamp(deco_val,MAXVAL);
+        row_buffer.update(q_channel_value,col);
+        ctx_model.update_context(context, q_error,z,y);
 
-        row_buffer.end_row();
-        init_col= 0;
+        // store in output image
+        row_ptr[col] = q_channel_value;
       }
-    }else{
-      for (int row = 0; row < decoded_img.rows; ++row){
-        row_buffer.start_row();
-        uchar * const row_ptr =  decoded_img.ptr<uchar>(row);
-        for (int col = init_col; col < decoded_img.cols; ++col){
-          
-          int prediction;
-          Context_t context;
-          get_prediction_and_context(row_buffer,col, MAXVAL,context,prediction);
-
-           // entropy decoding
-          int z,y,q_error;
-          bin_decoder.retrive_TSG_symbol(get_context_theta_idx(context),ctx_p_idx[context.id],escape_bits,z,y);
-
-          int error = y ==1? -z -1:z;
-          q_error = error*delta;
-          q_error = (ctx_acc[context.id] > 0)?-q_error:q_error;
-          int deco_val = (prediction + mult_by_sign(q_error,context.sign));
-        
-          #if ERROR_REDUCTION 
-            if(unlikely(deco_val < MIN_REDUCT_ERROR)){
-              deco_val += DECO_RANGE;
-            }else if(unlikely(deco_val > MAX_REDUCT_ERROR)){
-              deco_val -= DECO_RANGE;
-            }
-          #endif 
-
-          int q_channel_value = clamp(deco_val,MAXVAL);
-          row_buffer.update(q_channel_value,col);
-          update_context(context, q_error,z,y);
-          
-          // store in output image
-          row_ptr[col] = q_channel_value;
-        }
 
-        row_buffer.end_row();
-        init_col= 0;
+      row_buffer.end_row();
+      strip_end_row(strip,row);
+      init_col= 0;
+    }
+  }
+
+  template <class Context_model_t>
+  struct decoder_scan_kernel_t{
+    Binary_Decoder &bin_decoder;
+    cv::Mat& decoded_img;
+    Context_model_t &ctx_model;
+    int near;
+    const codec_params_t &params;
+    const strip_link_t *strip;
+
+    template <int IBPP>
+    void run(){
+      if(near == 0) {
+        lossless_decode_kernel<IBPP>(bin_decoder,decoded_img,ctx_model,params,
+                                                                        strip);
+      }else{
+        near_lossless_decode_kernel<IBPP>(bin_decoder,decoded_img,ctx_model,near,
+                                                                  params,strip);
       }
     }
+  };
+
+  template <class Context_model_t>
+  void binary_scanner(unsigned char* block_binary,cv::Mat& decoded_img,
+                        Context_model_t &ctx_model, int near,
+                        const codec_params_t &params, int num_ANS_states = 1,
+                        const strip_link_t *strip = nullptr,
+                        const tANS_coder_tables_t *tables = nullptr,
+                        uint ee_buffer_size = EE_BUFFER_SIZE){
+    int num_of_symbols = get_num_of_symbs(decoded_img.rows,decoded_img.cols,CHROMA_MODE_GRAY);
+    Binary_Decoder bin_decoder(block_binary,num_of_symbols,num_ANS_states,tables,
+                                                                  ee_buffer_size);
+
+    {
+      int channel_value = bin_decoder.retrive_pixel(params.INPUT_BPP);
+      #if DEBUG
+        printf("First channel_value: %0X\n",channel_value );
+      #endif
+      set_value(decoded_img,0,0,channel_value);
+    }
 
+    decoder_scan_kernel_t<Context_model_t> kernel{bin_decoder,decoded_img,ctx_model,
+                                              near,params,strip};
+    scan_dispatch(params,kernel);
   }
 
 
   void decode_core(unsigned char* in_file ,cv::Mat& decode_img,char chroma_mode,
     char _fixed_prediction_alg , int near , uint ee_buffer_size, 
-    int ibpp, char encoder_mode){
-
+    int ibpp, char encoder_mode, int num_ANS_states, const strip_link_t *strip,
+    const ::tANS_coder_tables_t *profile_tables, uint8_t block_type){
+    const tANS_coder_tables_t *tables = static_cast<const tANS_coder_tables_t*>(profile_tables);
 
     if(chroma_mode != CHROMA_MODE_GRAY) {
       std::cerr<< "chroma_mode != CHROMA_MODE_GRAY.";
@@ -476,11 +1038,38 @@ void set_codec_parameters(int ibpp,int near){
       //Other modes are not currently supported 
       throw 1;
     }
-    set_codec_parameters(ibpp,near);
+    const codec_params_t params = get_codec_parameters(ibpp,near);
+
+    // stored and constant blocks don't need the decoder
+    if(block_type == BLOCK_TYPE_STORED || block_type == BLOCK_TYPE_CONSTANT) {
+      for(int row = 0; row < decode_img.rows; ++row) {
+        uchar * const row_ptr = decode_img.ptr<uchar>(row);
+        if(block_type == BLOCK_TYPE_CONSTANT) {
+          memset(row_ptr,in_file[0],decode_img.cols);
+        }else{
+          memcpy(row_ptr,in_file + row*decode_img.cols,decode_img.cols);
+        }
+      }
+      strip_end_row(strip,decode_img.rows-1);
+      return;
+    }
 
-    binary_scanner(in_file,decode_img,near);
+    if(block_type == BLOCK_TYPE_STATIC) {
+      Static_context_model ctx_model(near,params.ALPHA);
+      const size_t model_size = ctx_model.read(in_file);
+      binary_scanner(in_file+model_size,decode_img,ctx_model,near,params,
+                                    num_ANS_states,strip,tables,ee_buffer_size);
+    }else{
+      Context_model ctx_model(near,params.ALPHA);
+      binary_scanner(in_file,decode_img,ctx_model,near,params,num_ANS_states,
+                                                  strip,tables,ee_buffer_size);
+    }
 
   }
 
+  // entry points of the profile (see get_coder_profile_api)
+  extern const coder_profile_api_t profile_api;
+  const coder_profile_api_t profile_api = {CODER_PROFILE_NAME,
+      encode_core,decode_core,get_image_tANS_tables,load_image_tANS_tables};
 
-
+} // namespace CODER_PROFILE_NS
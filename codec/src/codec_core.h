@@ -34,6 +34,8 @@
 #include <functional> 
 #include <cmath>
 #include <cstring> //memcopy
+#include <atomic>
+#include <memory>
 
 #include "coder_config.h"
 
@@ -42,6 +44,9 @@ constexpr int MAX_IBPP = 8;
 #define Orig_CTX_Quant false
 #define MU_estim_like_original false
 #define MAX_SUPPORTED_BPP (32) // has to be mult of 8
+#define DECODER_INPUT_PADDING (8) // bytes the decoder may read after the binary
+#define ENCODER_OUTPUT_PADDING (64) // output bytes the encoder may use beyond
+                                    // MAX_SUPPORTED_BPP per pixel
 
 // SYMBOL_ENDIANNESS_LITTLE:
 // packs of bits stored in little endian
@@ -79,6 +84,51 @@ constexpr int MAX_IBPP = 8;
 
 #define ENCODER_PRED_LOCO 0
 
+/* Strip mode: the image is coded in vertical strips (blocks as tall as the 
+ * image), and the first columns of a strip are predicted using the last 
+ * columns of the strip on its left, which are read from the image the block
+ * is a view of. A row can be coded once the same row of the left strip is 
+ * done, so strips are processed as a wavefront. 
+ */
+struct strip_link_t {
+  bool has_left_strip; // false for the first strip
+  const std::atomic<int> *left_rows_done; // nullptr: left pixels already available
+  std::atomic<int> *rows_done; // rows completed by this strip (nullptr: not notified)
+  strip_link_t():has_left_strip(false),left_rows_done(nullptr),rows_done(nullptr){}
+};
+/* Block types: blocks that don't benefit from coding are stored raw, and
+ * blocks with a single value only store that value. These two aren't used in
+ * near-lossless strip mode, as the right strip is predicted from the 
+ * reconstructed values of the coded block.
+ * Static model blocks are coded with fixed context parameters, fitted by the
+ * encoder (see Static_context_model), which makes decoding faster.
+ */
+#define BLOCK_TYPE_CODED (0)
+#define BLOCK_TYPE_STORED (1) // a byte per pixel, in raster order
+#define BLOCK_TYPE_CONSTANT (2) // a byte with the value of all the pixels
+#define BLOCK_TYPE_STATIC (3) // static model section + binary
+#define STATIC_MODEL_MAX_SIZE (4096) // bytes
+
+/* Two-pass mode: tANS tables tuned for the image (see ANS_coder.h). 
+ * The tables of each coder profile are only defined in its ANS_coder.h 
+ * namespace, and they derive from this struct. Tables are only valid for the
+ * profile that built them.
+ */
+struct tANS_coder_tables_t {};
+
+// First pass: gets the tANS symbol statistics of src, coded as a single 
+// block, and builds tables for the modes that are worth tuning, storing them 
+// in table_section. Returns nullptr (and an empty table_section) if the 
+// default tables are better. With static_model, the statistics are taken
+// with a static model fitted to the whole image
+std::shared_ptr<const tANS_coder_tables_t> get_image_tANS_tables(const cv::Mat& src, 
+                        int near, int ibpp, std::vector<uint8_t> &table_section,
+                        bool static_model=false, int coder_profile=CODER_PROFILE_DEFAULT);
+
+// Builds the tables of a table section
+std::shared_ptr<const tANS_coder_tables_t> load_image_tANS_tables(
+                                    const std::vector<uint8_t> &table_section,
+                                    int coder_profile=CODER_PROFILE_DEFAULT);
 
 uint32_t encode_core(const cv::Mat& src,
                           cv::Mat & quant_img, 
@@ -87,15 +137,51 @@ uint32_t encode_core(const cv::Mat& src,
                           char _fixed_prediction_alg = ENCODER_PRED_LOCO, // not currently in use
                           int near = 1, 
                           char encoder_mode=0, 
-                          int ibpp=8);
+                          int ibpp=8,
+                          bool pipelined=false, // tANS coding in a 2nd thread
+                          int num_ANS_states=1, // interleaved tANS states
+                          const strip_link_t *strip=nullptr,
+                          const tANS_coder_tables_t *tables=nullptr, // nullptr: default
+                          uint ee_buffer_size=EE_BUFFER_SIZE, // symbols per tANS chunk
+                          uint8_t *block_type=nullptr, // nullptr: always coded
+                          bool static_model=false, // requires block_type
+                          int coder_profile=CODER_PROFILE_DEFAULT);
 
 void decode_core(unsigned char* in_file ,cv::Mat& decode_img,
                         char chroma_mode=CHROMA_MODE_YUV444, 
                         char _fixed_prediction_alg = ENCODER_PRED_LOCO, // not currently in use
                         int near = 1,  
-                        uint ee_buffer_size = 2096,
+                        uint ee_buffer_size = EE_BUFFER_SIZE,
                         int ibpp=8,
-                        char mode =0);
+                        char mode =0,
+                        int num_ANS_states=1,
+                        const strip_link_t *strip=nullptr,
+                        const tANS_coder_tables_t *tables=nullptr, // nullptr: default
+                        uint8_t block_type=BLOCK_TYPE_CODED,
+                        int coder_profile=CODER_PROFILE_DEFAULT);
+
+/* Coder profile entry points (see Coder profiles in coder_config.h):
+ * the codec core functions above of a profile, without the coder_profile 
+ * parameter. The ones above call the ones of coder_profile.
+ */
+struct coder_profile_api_t {
+  const char *name;
+  uint32_t (*encode_core)(const cv::Mat&,cv::Mat&,uint8_t*,char,char,int,char,
+                              int,bool,int,const strip_link_t*,
+                              const tANS_coder_tables_t*,uint,uint8_t*,bool);
+  void (*decode_core)(unsigned char*,cv::Mat&,char,char,int,uint,int,char,int,
+                              const strip_link_t*,const tANS_coder_tables_t*,uint8_t);
+  std::shared_ptr<const tANS_coder_tables_t> (*get_image_tANS_tables)(
+                              const cv::Mat&,int,int,std::vector<uint8_t>&,bool);
+  std::shared_ptr<const tANS_coder_tables_t> (*load_image_tANS_tables)(
+                              const std::vector<uint8_t>&);
+};
+
+// Returns nullptr if coder_profile isn't a valid profile
+const coder_profile_api_t* get_coder_profile_api(int coder_profile);
+
+// Returns the profile with that name, or -1 if there isn't any
+int get_coder_profile_id(const char *name);
 
 void rgb2yuv(const cv::Mat& src,cv::Mat&  dst,char chroma_mode =CHROMA_MODE_YUV444);
 
@@ -110,6 +196,9 @@ struct Context_t{
 };
 
 
+// the row buffer depends on the coder profile (ADD_GRAD_4)
+namespace CODER_PROFILE_NS {
+
 #if ADD_GRAD_4
   constexpr int extra_cols_before = 2;
 #else
@@ -120,17 +209,21 @@ constexpr int extra_cols_after = 1;
 constexpr int extra_cols= extra_cols_before + extra_cols_after;
 constexpr int col_idx_off = extra_cols_before;
 
+static_assert(MAX_IBPP <= 8, "RowBuffer and LosslessRowView store 8-bit pixels");
+
+// Reconstructed rows of near-lossless coding (lossless coding reads the image
+// rows, see LosslessRowView)
 class RowBuffer
   {
   public:
     int cols;
     int curr_row_idx;
-    unsigned int * prev_row;
-    unsigned int * current_row;
+    uchar * prev_row;
+    uchar * current_row;
 
     RowBuffer(int _cols):cols(_cols),curr_row_idx(0){
-      prev_row = new unsigned int[_cols+extra_cols];
-      current_row = new unsigned int[_cols+extra_cols];
+      prev_row = new uchar[_cols+extra_cols];
+      current_row = new uchar[_cols+extra_cols];
       for(int i = 0; i < _cols+extra_cols; ++i) {
         prev_row[i]= 0;
         current_row[i]= 0;
@@ -153,12 +246,26 @@ class RowBuffer
       }*/
     }
 
+    // strip mode: left extra cols are taken from the pixels on the left of
+    // row_ptr (last columns of the left strip)
+    inline void start_row(const uchar * const row_ptr){
+      for(int i = 1; i <= extra_cols_before; ++i) {
+        current_row[col_idx_off-i]= row_ptr[-i];
+      }
+    }
+
+    inline void copy_prev_row(uchar * const row_ptr) const{
+      for(int col = 0; col < cols; ++col) {
+        row_ptr[col] = prev_row[col+col_idx_off];
+      }
+    }
+
     inline void end_row(){
       // copy last sample to extra col on the right 
       current_row[cols+col_idx_off] =current_row[cols-1+col_idx_off]; 
 
       // swap row pointers
-      unsigned int * aux = prev_row;
+      uchar * aux = prev_row;
       prev_row = current_row;
       current_row = aux;
       curr_row_idx = curr_row_idx?1:0;
@@ -189,6 +296,86 @@ class RowBuffer
     
   };
 
+/* Lossless row view:
+ * In lossless mode the reconstructed image is the source image (encoder) or
+ * the output image (decoder), so the prediction template is read from the 
+ * cv::Mat rows instead of being copied to a RowBuffer. prev and curr point to
+ * column 0 of the previous and current rows (prev is a row of zeros for the
+ * first row). The columns whose template goes out of the row, the first 
+ * extra_cols_before ones and the last one, are peeled: their template is read
+ * from small shadow windows (head and tail), which are padded with the values 
+ * of the RowBuffer extra cols.
+ */
+class LosslessRowView
+  {
+  public:
+    static constexpr int win_cols = 2*extra_cols_before+1;
+    int cols;
+    int head_cols; // peeled cols at the start of the row: [0,head_cols)
+    int tail_col; // peeled cols at the end of the row: [tail_col,cols)
+    const uchar * prev;
+    const uchar * curr;
+
+    LosslessRowView(int _cols):cols(_cols),zero_row(_cols,0){
+      head_cols = std::min(extra_cols_before,cols);
+      tail_col = std::max(head_cols,cols-1);
+      prev = zero_row.data();
+      curr = zero_row.data();
+      for(int i = 0; i < extra_cols_before; ++i) {
+        prev_left[i] = 0;
+        curr_left[i] = 0;
+      }
+    }
+
+    // left_strip: the pixels on the left of the rows are the last columns of
+    // the left strip (strip mode)
+    inline void start_row(const cv::Mat &img, int row, bool left_strip){
+      prev = row > 0 ? img.ptr<uchar>(row-1) : zero_row.data();
+      curr = img.ptr<uchar>(row);
+      for(int i = 0; i < extra_cols_before; ++i) {
+        prev_left[i] = curr_left[i];
+        curr_left[i] = left_strip? curr[-1-i] : prev[0];
+      }
+      fill_window(prev,prev_left,0,prev_head);
+      fill_window(curr,curr_left,0,curr_head);
+      if(tail_col < cols) {
+        fill_window(prev,prev_left,tail_col,prev_tail);
+        fill_window(curr,curr_left,tail_col,curr_tail);
+      }
+    }
+
+    // windows, pointing to column 0 (head) or tail_col (tail). The decoder 
+    // stores the decoded head cols in curr_head
+    inline const uchar * head_prev() const{ return prev_head+extra_cols_before;}
+    inline uchar * head_curr() { return curr_head+extra_cols_before;}
+    inline const uchar * head_curr() const{ return curr_head+extra_cols_before;}
+    inline const uchar * tail_prev() const{ return prev_tail+extra_cols_before;}
+    inline const uchar * tail_curr() const{ return curr_tail+extra_cols_before;}
+
+  private:
+    std::vector<uchar> zero_row;
+    uchar prev_left[extra_cols_before], curr_left[extra_cols_before]; // cols -1, -2
+    uchar prev_head[win_cols], curr_head[win_cols];
+    uchar prev_tail[win_cols], curr_tail[win_cols];
+
+    // window of the cols [col-extra_cols_before,col+extra_cols_before]
+    inline void fill_window(const uchar *row_ptr, const uchar *left, int col, 
+                                                              uchar *win) const{
+      for(int i = 0; i < win_cols; ++i) {
+        const int win_col = col - extra_cols_before + i;
+        if(win_col < 0) {
+          win[i] = left[-win_col-1];
+        }else if(win_col < cols) {
+          win[i] = row_ptr[win_col];
+        }else{
+          win[i] = row_ptr[cols-1]; // extra col on the right
+        }
+      }
+    }
+  };
+
+} // namespace CODER_PROFILE_NS
+
 
 
 struct ee_symb_data {
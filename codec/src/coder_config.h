@@ -2,26 +2,57 @@
 #ifndef CODER_CONFIG_H
 #define CODER_CONFIG_H
 
+/* Coder profiles:
+ * ADD_GRAD_4, CTX_ST_FINER_QUANT, HALF_Y_CODER, LOG2_NUM_ANS_STATES,
+ * EE_MAX_ITERATIONS and the tANS tables can be set per coder profile (the
+ * current profiles keep HALF_Y_CODER enabled). The codec
+ * core is compiled once per profile, in the profile namespace
+ * (CODER_PROFILE_NS): codec_core.cc is the default profile, with the values
+ * below, and codec_core_<profile>.cc the other ones, which set their values
+ * (coder_profile_<profile>.h, with their tANS tables file) before including it. The profile is recorded in the file header, so files
+ * coded with any profile can be decoded (see get_coder_profile_api).
+ */
+#define CODER_PROFILE_DEFAULT (0)
+#define CODER_PROFILE_FAST (1) // fewer contexts and escape iterations
+#define CODER_PROFILE_DENSE (2) // larger tANS tables
+#define NUM_CODER_PROFILES (3)
+
+#ifndef CODER_PROFILE_NS
+  #define CODER_PROFILE_NS coder_profile_default
+  #define CODER_PROFILE_NAME "default"
+#endif
 
-#define ADD_GRAD_4 (true)
+#ifndef ADD_GRAD_4
+  #define ADD_GRAD_4 (true)
+#endif
 
 //quantizers
-#define CTX_ST_FINER_QUANT (true) 
+#ifndef CTX_ST_FINER_QUANT
+  #define CTX_ST_FINER_QUANT (true) 
+#endif
 #define CTX_ST_PRECISION (8) // number of fractional bits
 #define MAX_ST_IDX  (31)//31//25 //(12)
 
 #define CTX_NT_CENTERED_QUANT (true)
 #define CTX_NT_PRECISION (6) // number of fractional bits
-#define HALF_Y_CODER (true) 
+#ifndef HALF_Y_CODER
+  #define HALF_Y_CODER (true) 
+#endif
 
 // ANS coder 
 #define ANS_MAX_SRC_CARDINALITY (9)
-#define EE_MAX_ITERATIONS (7)
+#ifndef EE_MAX_ITERATIONS
+  #define EE_MAX_ITERATIONS (7)
+#endif
+static_assert(EE_MAX_ITERATIONS >= 1 && EE_MAX_ITERATIONS <= 7,
+      "EE_MAX_ITERATIONS above 7 is not supported by the z escape coding");
 #define EE_BUFFER_SIZE (16384)
 
 #define NUM_ANS_THETA_MODES (32)//16 // supported theta_modes
 #define NUM_ANS_P_MODES (32) //16 //32 // supported theta_modes
-#define LOG2_NUM_ANS_STATES (7)
+#ifndef LOG2_NUM_ANS_STATES
+  #define LOG2_NUM_ANS_STATES (7)
+#endif
 #define NUM_ANS_STATES (1<<LOG2_NUM_ANS_STATES)  // NUM_ANS_STATES only considers I range
 
 static const uint8_t tANS_cardinality_table[32] = {	1,1,1,1,1,1,1,1,1,1,1,2,2,2,2,4,4,4,8,8,8,8,8,8,8,8,8,8,8,8,8,8};
@@ -0,0 +1,32 @@
+/*
+  Copyright 2021 Tobías Alonso, Autonomous University of Madrid
+
+  This file is part of LOCO-ANS.
+
+  LOCO-ANS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  LOCO-ANS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with LOCO-ANS.  If not, see <https://www.gnu.org/licenses/>.
+
+
+ */
+
+#ifndef CODER_PROFILE_DENSE_H
+#define CODER_PROFILE_DENSE_H
+
+// Dense coder profile (see Coder profiles in coder_config.h): twice the tANS
+// states, for a closer approximation of the symbol probabilities
+#define CODER_PROFILE_NS coder_profile_dense
+#define CODER_PROFILE_NAME "dense"
+#define LOG2_NUM_ANS_STATES (8)
+#define ANS_TABLES_FILE "ANS_tables/dense/tANS_tables.h"
+
+#endif // CODER_PROFILE_DENSE_H
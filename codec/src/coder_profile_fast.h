@@ -0,0 +1,34 @@
+/*
+  Copyright 2021 Tobías Alonso, Autonomous University of Madrid
+
+  This file is part of LOCO-ANS.
+
+  LOCO-ANS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  LOCO-ANS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with LOCO-ANS.  If not, see <https://www.gnu.org/licenses/>.
+
+
+ */
+
+#ifndef CODER_PROFILE_FAST_H
+#define CODER_PROFILE_FAST_H
+
+// Fast coder profile (see Coder profiles in coder_config.h): no 4th gradient
+// in the context (fewer contexts to update) and fewer z escape iterations
+#define CODER_PROFILE_NS coder_profile_fast
+#define CODER_PROFILE_NAME "fast"
+#define ADD_GRAD_4 (false)
+#define CTX_ST_FINER_QUANT (false)
+#define EE_MAX_ITERATIONS (5)
+#define ANS_TABLES_FILE "ANS_tables/fast/tANS_tables.h"
+
+#endif // CODER_PROFILE_FAST_H
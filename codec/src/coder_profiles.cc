@@ -0,0 +1,90 @@
+/*
+  Copyright 2021 Tobías Alonso, Autonomous University of Madrid
+
+  This file is part of LOCO-ANS.
+
+  LOCO-ANS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  LOCO-ANS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with LOCO-ANS.  If not, see <https://www.gnu.org/licenses/>.
+
+
+ */
+#include "codec_core.h"
+
+// Coder profiles (see coder_config.h). Each codec_core*.cc defines the entry
+// points of a profile in its namespace
+namespace coder_profile_default { extern const coder_profile_api_t profile_api; }
+namespace coder_profile_fast { extern const coder_profile_api_t profile_api; }
+namespace coder_profile_dense { extern const coder_profile_api_t profile_api; }
+
+static const coder_profile_api_t* const coder_profiles[NUM_CODER_PROFILES] = {
+  &coder_profile_default::profile_api, // CODER_PROFILE_DEFAULT
+  &coder_profile_fast::profile_api, // CODER_PROFILE_FAST
+  &coder_profile_dense::profile_api // CODER_PROFILE_DENSE
+};
+
+const coder_profile_api_t* get_coder_profile_api(int coder_profile){
+  if(coder_profile < 0 || coder_profile >= NUM_CODER_PROFILES) {
+    return nullptr;
+  }
+  return coder_profiles[coder_profile];
+}
+
+int get_coder_profile_id(const char *name){
+  for(int profile = 0; profile < NUM_CODER_PROFILES; ++profile) {
+    if(strcmp(coder_profiles[profile]->name,name) == 0) {
+      return profile;
+    }
+  }
+  return -1;
+}
+
+static const coder_profile_api_t& get_checked_profile_api(int coder_profile){
+  const coder_profile_api_t* api = get_coder_profile_api(coder_profile);
+  if(api == nullptr) {
+    std::cerr<<"Error: Unknown coder profile: "<<coder_profile<<std::endl;
+    throw 1;
+  }
+  return *api;
+}
+
+std::shared_ptr<const tANS_coder_tables_t> get_image_tANS_tables(const cv::Mat& src, 
+                        int near, int ibpp, std::vector<uint8_t> &table_section,
+                        bool static_model, int coder_profile){
+  return get_checked_profile_api(coder_profile).get_image_tANS_tables(src,near,
+                                                  ibpp,table_section,static_model);
+}
+
+std::shared_ptr<const tANS_coder_tables_t> load_image_tANS_tables(
+                      const std::vector<uint8_t> &table_section, int coder_profile){
+  return get_checked_profile_api(coder_profile).load_image_tANS_tables(table_section);
+}
+
+uint32_t encode_core(const cv::Mat& src,cv::Mat & quant_img,uint8_t* binary_file, 
+    char chroma_mode, char _fixed_prediction_alg, int near, char encoder_mode,
+    int ibpp, bool pipelined, int num_ANS_states, const strip_link_t *strip, 
+    const tANS_coder_tables_t *tables, uint ee_buffer_size, uint8_t *block_type,
+    bool static_model, int coder_profile){
+  return get_checked_profile_api(coder_profile).encode_core(src,quant_img,
+            binary_file,chroma_mode,_fixed_prediction_alg,near,encoder_mode,ibpp,
+            pipelined,num_ANS_states,strip,tables,ee_buffer_size,block_type,
+            static_model);
+}
+
+void decode_core(unsigned char* in_file ,cv::Mat& decode_img,char chroma_mode,
+    char _fixed_prediction_alg , int near , uint ee_buffer_size, int ibpp, 
+    char encoder_mode, int num_ANS_states, const strip_link_t *strip,
+    const tANS_coder_tables_t *tables, uint8_t block_type, int coder_profile){
+  get_checked_profile_api(coder_profile).decode_core(in_file,decode_img,
+            chroma_mode,_fixed_prediction_alg,near,ee_buffer_size,ibpp,
+            encoder_mode,num_ANS_states,strip,tables,block_type);
+}
@@ -24,6 +24,13 @@
 
 #include "codec_core.h"
 #include <array>
+#include <map>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+#endif
+
+namespace CODER_PROFILE_NS {
 
 
 #define CTX_DIMS 3
@@ -47,20 +54,6 @@ constexpr int  CTX_0 = 0;
 
 #define CTX_BINS (CTX_GRAD_BINS ) 
 
-// Context state variables
-std::array<int, CTX_BINS> ctx_cnt={0};
-
-std::array<int, CTX_BINS> ctx_acc={0};
-std::array<int, CTX_BINS> ctx_mean={0};
-
-std::array<int, CTX_BINS> ctx_Nt={0};
-std::array<int, CTX_BINS> ctx_p_idx={0};
-
-std::array<int, CTX_BINS> ctx_St={0};
-#if ! ITERATIVE_ST
-std::array<int, CTX_BINS> ctx_St_idx={0};
-#endif
-
 #define CTX_MU_PRECISION 0  // number of fractional bits
 #define CTX_MU_ACC_BITS 11  // number of bits
 const int CTX_MU_FACTOR = int(pow(2,CTX_MU_PRECISION));
@@ -85,15 +78,18 @@ const int ctx_initial_Nt = 0;
 
 
 
-int gradient_quantizer(int g){
-  int T0=0,T1=3,T2=7,T3=21;
+// gradient quantizer thresholds (also used by the SIMD row context code)
+constexpr int GRAD_QUANT_T0 = 0, GRAD_QUANT_T1 = 3, GRAD_QUANT_T2 = 7, GRAD_QUANT_T3 = 21;
+
+constexpr int gradient_quantizer(int g){
+  int T0=GRAD_QUANT_T0,T1=GRAD_QUANT_T1,T2=GRAD_QUANT_T2,T3=GRAD_QUANT_T3;
   int sign = 1;
   if(g < 0){
     sign = -1;
     g = -g;
   }
 
-  int q;
+  int q = 0;
   // check from high to low probability
   if(g <= T0){
     q = 0;
@@ -121,7 +117,34 @@ inline int mult_by_sign( int val, int sign) {
   return (sign ^ val) - sign;
 }
 
- int8_t _gradient_quant[256*2],*gradient_quant;
+constexpr int GRAD4_QUANT_T = 5;
+
+constexpr int grad4_quant(int g){
+  constexpr int T4 = GRAD4_QUANT_T;
+  if( g <= -T4){
+    return -1;
+  }else if( g < T4){
+    return 0;
+  }else{
+    return 1;
+  }
+}
+
+// Gradient quantization LUTs (gradients in [-255, 255]). They are computed at
+// compile time, and shared by all the context models (and threads)
+struct gradient_quant_luts_t {
+  int8_t grad[256*2];
+  int8_t grad4[256*2];
+  constexpr gradient_quant_luts_t():grad(),grad4(){
+    for(int i = -255; i < 256; ++i) {
+      grad[i+255] = gradient_quantizer(i);
+      grad4[i+255] = grad4_quant(i);
+    }
+  }
+};
+constexpr gradient_quant_luts_t gradient_quant_luts;
+const int8_t *const gradient_quant = gradient_quant_luts.grad+255;
+const int8_t *const gradient4_quant = gradient_quant_luts.grad4+255;
 
 Context_t map_gradients_to_int(int g1, int g2, int g3){
   // int q1 = gradient_quantizer(g1);
@@ -144,19 +167,6 @@ Context_t map_gradients_to_int(int g1, int g2, int g3){
   return Context_t(context_id,sign);
 }
 
-int grad4_quant(int g){
-  constexpr int T4 = 5;
-  if( g <= -T4){
-    return -1;
-  }else if( g < T4){
-    return 0;
-  }else{
-    return 1;
-  }
-}
-
-int8_t _gradient4_quant[256*2],*gradient4_quant;
-
 Context_t map_gradients_to_int(int g1, int g2, int g3, int g4){
   int q1  = *(gradient_quant+g1);
   int q2  = *(gradient_quant+g2);
@@ -174,46 +184,172 @@ Context_t map_gradients_to_int(int g1, int g2, int g3, int g4){
   return Context_t(context_id,sign);
 }
 
+/* Row contexts:
+ * The gradients d-b and b-c only depend on the previous row, so their part of
+ * the context id, (q1*CTX_BINS_PER_DIM + q2)*CTX_ROW_CTX_FACTOR, is computed
+ * for a whole row before coding it (get_row_contexts). The per-pixel code
+ * then only adds the terms that depend on a (map_row_context_to_int).
+ * prev_row points to column 0 of the previous row (8-bit pixels), and it
+ * needs a valid column before and after the cols of the row (RowBuffer extra
+ * cols or LosslessRowView windows).
+ * get_row_contexts uses AVX2 or SSE4.1 if the CPU supports them, otherwise 
+ * it falls back to the scalar version.
+ */
+#if ADD_GRAD_4
+  #define CTX_ROW_CTX_FACTOR (CTX_BINS_PER_DIM*3)
+#else
+  #define CTX_ROW_CTX_FACTOR (CTX_BINS_PER_DIM)
+#endif
 
+typedef void (*row_contexts_fn_t)(const uchar *prev_row, int cols, 
+                                                            int32_t *row_ctx);
 
-inline int get_context_bias(Context_t context){
-  #if CTX_MU_PRECISION == 0
-    return mult_by_sign(ctx_mean[context.id],context.sign);
-  #else
-    const int abs_bias = (CTX_MU_FACTOR/2)-1;
-    int bias = ctx_mean[context.id]>0? abs_bias:-abs_bias;
-    return mult_by_sign(((ctx_mean[context.id]+bias)/CTX_MU_FACTOR),context.sign);
-  #endif
+static void get_row_contexts_scalar(const uchar *prev_row, int cols,
+                                                            int32_t *row_ctx){
+  for(int col = 0; col < cols; ++col) {
+    const int b = prev_row[col];
+    const int q1 = *(gradient_quant + (prev_row[col+1] - b));
+    const int q2 = *(gradient_quant + (b - prev_row[col-1]));
+    row_ctx[col] = (q1*CTX_BINS_PER_DIM + q2)*CTX_ROW_CTX_FACTOR;
+  }
 }
 
-#if DEBUG
-static long WARN_MAX_ST_IDX_cnt = 0;
+#if CTX_BINS_PER_DIM == 9 && (defined(__x86_64__) || defined(__i386__))
+  #define ROW_CONTEXTS_SIMD 1
+#else
+  #define ROW_CONTEXTS_SIMD 0
 #endif
 
+#if ROW_CONTEXTS_SIMD
+// 8-bit pixels to 32-bit lanes
+__attribute__((target("avx2")))
+static inline __m256i load_px8_avx2(const uchar *px){
+  return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)px));
+}
 
-int get_st_idx(Context_t context){
-  int idx;
-  #if CTX_ST_FINER_QUANT
-    int e, l = ctx_cnt[context.id];
-    for(e = 0; ctx_St[context.id] > l; l<<=1,e+=2) {;}
-    // idx = e<<1;
-    idx = e;
-    if(ctx_St[context.id]> l-((l+2)>>2)){
-      idx++;
+__attribute__((target("sse4.1")))
+static inline __m128i load_px4_sse4(const uchar *px){
+  int32_t px4;
+  memcpy(&px4,px,sizeof(px4));
+  return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(px4));
+}
+
+// q = sign(g) * ((|g|>T0) + (|g|>=T1) + (|g|>=T2) + (|g|>=T3)). Compare 
+// results are -1, so the sum is negated by the sign step
+__attribute__((target("avx2")))
+static inline __m256i gradient_quantizer_avx2(__m256i g){
+  const __m256i abs_g = _mm256_abs_epi32(g);
+  __m256i q = _mm256_cmpgt_epi32(abs_g,_mm256_set1_epi32(GRAD_QUANT_T0));
+  q = _mm256_add_epi32(q,_mm256_cmpgt_epi32(abs_g,_mm256_set1_epi32(GRAD_QUANT_T1-1)));
+  q = _mm256_add_epi32(q,_mm256_cmpgt_epi32(abs_g,_mm256_set1_epi32(GRAD_QUANT_T2-1)));
+  q = _mm256_add_epi32(q,_mm256_cmpgt_epi32(abs_g,_mm256_set1_epi32(GRAD_QUANT_T3-1)));
+  return _mm256_sign_epi32(q,_mm256_sub_epi32(_mm256_setzero_si256(),g));
+}
+
+// grad4_quant: -1 if g <= -T, 1 if g >= T, 0 otherwise
+__attribute__((target("avx2")))
+static inline __m256i grad4_quant_avx2(__m256i g){
+  return _mm256_sub_epi32(_mm256_cmpgt_epi32(_mm256_set1_epi32(1-GRAD4_QUANT_T),g),
+                          _mm256_cmpgt_epi32(g,_mm256_set1_epi32(GRAD4_QUANT_T-1)));
+}
+
+__attribute__((target("avx2")))
+static void get_row_contexts_avx2(const uchar *prev_row, int cols,
+                                                            int32_t *row_ctx){
+  int col = 0;
+  for(; col + 8 <= cols; col += 8) {
+    const __m256i b = load_px8_avx2(prev_row+col);
+    const __m256i c = load_px8_avx2(prev_row+col-1);
+    const __m256i d = load_px8_avx2(prev_row+col+1);
+    const __m256i q1 = gradient_quantizer_avx2(_mm256_sub_epi32(d,b));
+    const __m256i q2 = gradient_quantizer_avx2(_mm256_sub_epi32(b,c));
+    const __m256i ctx = _mm256_mullo_epi32(_mm256_add_epi32(
+          _mm256_mullo_epi32(q1,_mm256_set1_epi32(CTX_BINS_PER_DIM)),q2),
+          _mm256_set1_epi32(CTX_ROW_CTX_FACTOR));
+    _mm256_storeu_si256((__m256i*)(row_ctx+col),ctx);
+  }
+  get_row_contexts_scalar(prev_row+col,cols-col,row_ctx+col);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i gradient_quantizer_sse4(__m128i g){
+  const __m128i abs_g = _mm_abs_epi32(g);
+  __m128i q = _mm_cmpgt_epi32(abs_g,_mm_set1_epi32(GRAD_QUANT_T0));
+  q = _mm_add_epi32(q,_mm_cmpgt_epi32(abs_g,_mm_set1_epi32(GRAD_QUANT_T1-1)));
+  q = _mm_add_epi32(q,_mm_cmpgt_epi32(abs_g,_mm_set1_epi32(GRAD_QUANT_T2-1)));
+  q = _mm_add_epi32(q,_mm_cmpgt_epi32(abs_g,_mm_set1_epi32(GRAD_QUANT_T3-1)));
+  return _mm_sign_epi32(q,_mm_sub_epi32(_mm_setzero_si128(),g));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i grad4_quant_sse4(__m128i g){
+  return _mm_sub_epi32(_mm_cmpgt_epi32(_mm_set1_epi32(1-GRAD4_QUANT_T),g),
+                          _mm_cmpgt_epi32(g,_mm_set1_epi32(GRAD4_QUANT_T-1)));
+}
+
+__attribute__((target("sse4.1")))
+static void get_row_contexts_sse4(const uchar *prev_row, int cols,
+                                                            int32_t *row_ctx){
+  int col = 0;
+  for(; col + 4 <= cols; col += 4) {
+    const __m128i b = load_px4_sse4(prev_row+col);
+    const __m128i c = load_px4_sse4(prev_row+col-1);
+    const __m128i d = load_px4_sse4(prev_row+col+1);
+    const __m128i q1 = gradient_quantizer_sse4(_mm_sub_epi32(d,b));
+    const __m128i q2 = gradient_quantizer_sse4(_mm_sub_epi32(b,c));
+    const __m128i ctx = _mm_mullo_epi32(_mm_add_epi32(
+          _mm_mullo_epi32(q1,_mm_set1_epi32(CTX_BINS_PER_DIM)),q2),
+          _mm_set1_epi32(CTX_ROW_CTX_FACTOR));
+    _mm_storeu_si128((__m128i*)(row_ctx+col),ctx);
+  }
+  get_row_contexts_scalar(prev_row+col,cols-col,row_ctx+col);
+}
+#endif
+
+static row_contexts_fn_t select_row_contexts_fn(){
+  #if ROW_CONTEXTS_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+      return get_row_contexts_avx2;
+    }
+    if(__builtin_cpu_supports("sse4.1")) {
+      return get_row_contexts_sse4;
     }
-  #else
-    for(idx = 0; ctx_St[context.id] > (ctx_cnt[context.id]<<(idx)); ++idx) {;}
   #endif
+  return get_row_contexts_scalar;
+}
 
+// selected once, at static initialization
+static const row_contexts_fn_t get_row_contexts = select_row_contexts_fn();
 
-  idx = idx>MAX_ST_IDX?MAX_ST_IDX:idx;
+#if ADD_GRAD_4
+inline Context_t map_row_context_to_int(int row_ctx, int g3, int g4){
+  int q3  = *(gradient_quant+g3);
+  int q4 = *(gradient4_quant+g4);
 
+  int context_id = row_ctx + q3*3 + q4 ;
+#else
+inline Context_t map_row_context_to_int(int row_ctx, int g3){
+  int q3  = *(gradient_quant+g3);
 
-  return idx;
+  int context_id = row_ctx + q3 ;
+#endif
+  int sign = context_id >> (sizeof(context_id)*8 - 1);
+  context_id = mult_by_sign(context_id, sign);
+
+  assert(context_id<CTX_BINS);
+  assert(0<=context_id);
+
+  return Context_t(context_id,sign);
 }
 
 
 
+#if DEBUG
+static thread_local long WARN_MAX_ST_IDX_cnt = 0;
+#endif
+
+
 inline int get_theta_idx(int ctx_cnt, int ctx_St){
   int idx;
   #if CTX_ST_FINER_QUANT
@@ -241,60 +377,165 @@ inline int get_theta_idx(int ctx_cnt, int ctx_St){
   return idx;
 }
 
-inline int get_context_theta_idx(Context_t context){
-  #if ITERATIVE_ST
-    return get_theta_idx( ctx_cnt[context.id],ctx_St[context.id] );
-  #else
-    return ctx_St_idx[context.id];
-  #endif
-}
 
+/* Context state variables. They are packed in a 16 byte record, so each 
+ * pixel only touches a cache line of the context model. Field sizes follow 
+ * the value ranges after update_context:
+ *  cnt in [1, CTX_ADJUST_CNT]
+ *  acc in [-(cnt+1)/2, cnt/2] (signed CTX_MU_ACC_BITS accumulator)
+ *  Nt: a few times CTX_ADJUST_CNT<<CTX_NT_PRECISION at most
+ *  p_idx in [0, 1<<CTX_NT_PRECISION], St_idx in [0, MAX_ST_IDX]
+ * mean (the bias) and St (sum of z<<CTX_ST_PRECISION) keep 32 bits. 
+ */
+struct alignas(16) context_state_t {
+  int32_t St;
+  int32_t mean;
+  int16_t acc;
+  int16_t Nt;
+  uint8_t cnt;
+  int8_t p_idx;
+  int8_t St_idx; // not used with ITERATIVE_ST
+};
+static_assert(sizeof(context_state_t) == 16, "context_state_t should take 16 bytes");
+static_assert(CTX_ADJUST_CNT <= UINT8_MAX, "context_state_t::cnt is too narrow");
+static_assert(MAX_ST_IDX <= INT8_MAX && (1<<CTX_NT_PRECISION) <= INT8_MAX, 
+                              "context_state_t::St_idx/p_idx are too narrow");
+static_assert(CTX_MU_ACC_BITS <= 16, "context_state_t::acc is too narrow");
+
+/* Context_model holds the adaptive state of the context modeler.
+ * Each block (tile) owns its own instance, which makes blocks independent 
+ * and allows to code them concurrently.
+ */
+class Context_model
+{
+public:
+  std::array<context_state_t, CTX_BINS> ctx_state;
+
+  Context_model(){}
+  Context_model(int near, int alpha){
+    context_reset(near, alpha);
+  }
+
+  inline int get_context_bias(Context_t context) const{
+    #if CTX_MU_PRECISION == 0
+      return mult_by_sign(ctx_state[context.id].mean,context.sign);
+    #else
+      const int abs_bias = (CTX_MU_FACTOR/2)-1;
+      int bias = ctx_state[context.id].mean>0? abs_bias:-abs_bias;
+      return mult_by_sign(((ctx_state[context.id].mean+bias)/CTX_MU_FACTOR),context.sign);
+    #endif
+  }
+
+  int get_st_idx(Context_t context) const{
+    int idx;
+    #if CTX_ST_FINER_QUANT
+      int e, l = ctx_state[context.id].cnt;
+      for(e = 0; ctx_state[context.id].St > l; l<<=1,e+=2) {;}
+      // idx = e<<1;
+      idx = e;
+      if(ctx_state[context.id].St> l-((l+2)>>2)){
+        idx++;
+      }
+    #else
+      for(idx = 0; ctx_state[context.id].St > (ctx_state[context.id].cnt<<(idx)); ++idx) {;}
+    #endif
+
+
+    idx = idx>MAX_ST_IDX?MAX_ST_IDX:idx;
+
+
+    return idx;
+  }
 
+  inline int get_context_theta_idx(Context_t context) const{
+    #if ITERATIVE_ST
+      return get_theta_idx( ctx_state[context.id].cnt,ctx_state[context.id].St );
+    #else
+      return ctx_state[context.id].St_idx;
+    #endif
+  }
 
+  inline int get_context_p_idx(Context_t context) const{
+    return ctx_state[context.id].p_idx;
+  }
 
+  // -1 if the error sign is inverted (positive context mean), 0 otherwise
+  inline int get_context_inv_sign(Context_t context) const{
+    return ctx_state[context.id].acc > 0? -1 : 0;
+  }
+
+  void context_init(int near, int alpha); // computes the initial state
+  void context_reset(int near, int alpha); // copies the initial state
+  void update_context(Context_t ctx, int prediction_error,int z, int y);
+};
+
+// Initial context model of each (near, alpha), computed once. Models are 
+// reset copying it, so the per-block setup is a single memcpy. Each thread
+// keeps the last snapshot it used (an image has a single (near, alpha)), so
+// the lock is only taken the first time a thread needs a snapshot
+const Context_model& get_initial_context_model(int near, int alpha){
+  static thread_local const Context_model* last_snapshot = nullptr;
+  static thread_local std::pair<int,int> last_key;
+  if(likely(last_snapshot != nullptr && last_key == std::make_pair(near,alpha))) {
+    return *last_snapshot;
+  }
+
+  static std::mutex snapshots_mutex;
+  static std::map<std::pair<int,int>,std::unique_ptr<Context_model>> snapshots;
+  std::lock_guard<std::mutex> lock(snapshots_mutex);
+  std::unique_ptr<Context_model> &snapshot = snapshots[std::make_pair(near,alpha)];
+  if(!snapshot) {
+    snapshot.reset(new Context_model());
+    snapshot->context_init(near,alpha);
+  }
+  last_snapshot = snapshot.get(); // snapshots are never released
+  last_key = std::make_pair(near,alpha);
+  return *snapshot;
+}
 
-void context_init(int near, int alpha){
+void Context_model::context_reset(int near, int alpha){
+  memcpy(ctx_state.data(),get_initial_context_model(near,alpha).ctx_state.data(),
+                                                              sizeof(ctx_state));
+}
+
+
+void Context_model::context_init(int near, int alpha){
   //variable init
-  for(auto & val: ctx_cnt){val=ctx_initial_cnt;}
-  for(auto & val: ctx_acc){val=0;}
-  for(auto & val: ctx_mean){val=0;}
+  context_state_t init_state;
+  init_state.cnt = ctx_initial_cnt;
+  init_state.acc = 0;
+  init_state.mean = 0;
   #if MU_estim_like_original
     int ctx_initial_p_idx = CTX_NT_HALF_IDX;
   #else
     int ctx_initial_p_idx = std::max(CTX_NT_HALF_IDX>>1 ,CTX_NT_HALF_IDX -2 -near);
   #endif
-  for(auto & val: ctx_p_idx){val=ctx_initial_p_idx;}
-  for(auto & val: ctx_Nt){val=ctx_initial_Nt;} 
+  init_state.p_idx = ctx_initial_p_idx;
+  init_state.Nt = ctx_initial_Nt;
 
   const int ctx_initial_St = std::max(2, ((alpha + 32) >> 6 ))<<CTX_ST_PRECISION;
-  for(auto & val: ctx_St){val=ctx_initial_St;}  
+  init_state.St = ctx_initial_St;
+  init_state.St_idx = 0;
+  ctx_state.fill(init_state);
   #if ! ITERATIVE_ST
     const int ctx_initial_St_idx =  get_st_idx(Context_t());
-    for(auto & val: ctx_St_idx){val=ctx_initial_St_idx;}  
+    for(auto & state: ctx_state){state.St_idx=ctx_initial_St_idx;}  
   #endif
 
-
-  gradient_quant = _gradient_quant+255;
-  gradient4_quant = _gradient4_quant+255;
-
-  for(int i = -255; i < 256; ++i) {
-    _gradient_quant[i+255] = gradient_quantizer(i);
-    *(gradient4_quant+i) = grad4_quant(i);
-  }
-
-
 }
 
-void update_context(Context_t ctx, int prediction_error,int z, int y){ 
+void Context_model::update_context(Context_t ctx, int prediction_error,int z, int y){ 
   int context = ctx.id;
-  auto & cnt = ctx_cnt[context];
-  auto & acc = ctx_acc[context];
-  auto & mean = ctx_mean[context];
-  auto & Nt = ctx_Nt[context];
-  auto & p_idx = ctx_p_idx[context];
-  auto & St = ctx_St[context];
+  // the record is loaded in int variables and stored once updated
+  context_state_t &state = ctx_state[context];
+  int cnt = state.cnt;
+  int acc = state.acc;
+  int mean = state.mean;
+  int Nt = state.Nt;
+  int p_idx = state.p_idx;
+  int St = state.St;
   #if !ITERATIVE_ST
-  auto & St_idx = ctx_St_idx[context];
+  int St_idx = state.St_idx;
   #endif
   //update accumulators and counters
     // ctx_acc[context] += context == CTX_0 ? 0: prediction_error<<CTX_MU_PRECISION; // CTX_0 shouldn't have bias
@@ -464,8 +705,217 @@ void update_context(Context_t ctx, int prediction_error,int z, int y){
       St  >>=1;
     }    
 
+  state.cnt = cnt;
+  state.acc = acc;
+  state.mean = mean;
+  state.Nt = Nt;
+  state.p_idx = p_idx;
+  state.St = St;
+  #if !ITERATIVE_ST
+  state.St_idx = St_idx;
+  #endif
+}
+
+
+/* Static context model (BLOCK_TYPE_STATIC blocks):
+ * Fixed per-context parameters, fitted to the block by the encoder and stored
+ * at the start of the block data. It has the Context_model interface, but 
+ * update_context does nothing, so the context lookups are read only and the
+ * next pixel parameters don't depend on the current one.
+ * Contexts with less than STATIC_CTX_MIN_CNT samples aren't worth their 
+ * parameters, so they share a default parameter set, fitted to all of them.
+ * Static model section: the default parameters, a bitmap with the fitted 
+ * contexts (bit id%8 of byte id/8) and the parameters of each fitted context.
+ * Parameters take 3 bytes: bias (int8_t), theta_id (bit 7: inverted error 
+ * sign) and p_id
+ */
+#define STATIC_CTX_MIN_CNT (64)
+#define STATIC_CTX_PARAMS_SIZE (3)
+#define STATIC_CTX_BITMAP_SIZE ((CTX_BINS+7)/8)
+static_assert(STATIC_CTX_BITMAP_SIZE + STATIC_CTX_PARAMS_SIZE*(CTX_BINS+1) <= 
+                      STATIC_MODEL_MAX_SIZE, "STATIC_MODEL_MAX_SIZE is too small");
+
+struct static_ctx_params_t {
+  int8_t bias;
+  int8_t inv_sign; // -1: error sign inverted
+  uint8_t theta_id;
+  uint8_t p_id;
+};
+
+// per-context statistics used to fit the parameters
+struct static_ctx_stats_t {
+  int64_t cnt, acc; // bias fit: prediction error sum
+  int64_t neg, pos; // coder parameters fit: number of errors < 0 and > 0,
+  int64_t z_acc, inv_z_acc; // and z sum without and with sign inversion
+  static_ctx_stats_t():cnt(0),acc(0),neg(0),pos(0),z_acc(0),inv_z_acc(0){}
+
+  void add(const static_ctx_stats_t &other){
+    cnt += other.cnt;
+    acc += other.acc;
+    neg += other.neg;
+    pos += other.pos;
+    z_acc += other.z_acc;
+    inv_z_acc += other.inv_z_acc;
+  }
+};
+
+class Static_context_model
+{
+public:
+  std::array<static_ctx_params_t, CTX_BINS> ctx_params;
+  std::array<bool, CTX_BINS> ctx_fitted;
+  static_ctx_params_t default_params; // of the contexts that aren't fitted
+
+  Static_context_model(int near, int alpha){
+    const Context_model &init_model = get_initial_context_model(near, alpha);
+    default_params.bias = 0;
+    default_params.inv_sign = 0;
+    default_params.theta_id = init_model.get_context_theta_idx(Context_t());
+    default_params.p_id = init_model.get_context_p_idx(Context_t());
+    ctx_params.fill(default_params);
+    ctx_fitted.fill(false);
+  }
+
+  inline int get_context_bias(Context_t context) const{
+    return mult_by_sign(ctx_params[context.id].bias,context.sign);
+  }
+
+  inline int get_context_theta_idx(Context_t context) const{
+    return ctx_params[context.id].theta_id;
+  }
+
+  inline int get_context_p_idx(Context_t context) const{
+    return ctx_params[context.id].p_id;
+  }
+
+  inline int get_context_inv_sign(Context_t context) const{
+    return ctx_params[context.id].inv_sign;
+  }
+
+  inline void update_context(Context_t ctx, int prediction_error,int z, int y){}
+
+  void fit_bias(const std::vector<static_ctx_stats_t> &stats);
+  void fit_coder_params(const std::vector<static_ctx_stats_t> &stats);
+
+  size_t write(uint8_t *data) const; // returns the section size
+  size_t read(const uint8_t *data); // returns the section size
+
+private:
+  void set_default_params(){
+    for(int ctx = 0; ctx < CTX_BINS; ++ctx) {
+      if(!ctx_fitted[ctx]) {
+        ctx_params[ctx] = default_params;
+      }
+    }
+  }
+};
+
+static void fit_static_ctx_bias(const static_ctx_stats_t &stats,static_ctx_params_t &params){
+  if(stats.cnt == 0) {
+    return;
+  }
+  const int bias = std::floor(stats.acc/double(stats.cnt) + 0.5);
+  params.bias = std::min(std::max(bias,-128),127);
+}
+
+// Same quantization as the adaptive model, using the block statistics
+static void fit_static_ctx_coder_params(const static_ctx_stats_t &stats,
+                                                static_ctx_params_t &params){
+  if(stats.cnt == 0) {
+    return;
+  }
+  params.inv_sign = stats.pos > stats.neg? -1 : 0;
+  int64_t cnt = stats.cnt;
+  const int64_t Nt = params.inv_sign? stats.pos : stats.neg;
+  int64_t St = (params.inv_sign? stats.inv_z_acc : stats.z_acc) << CTX_ST_PRECISION;
+
+  #if CTX_NT_CENTERED_QUANT
+    const int p_idx = (2*(Nt<<CTX_NT_PRECISION) + cnt)/(2*cnt);
+  #else
+    const int p_idx = (Nt<<CTX_NT_PRECISION)/cnt;
+  #endif
+  params.p_id = std::min(p_idx,MAX_Nt_IDX);
+
+  while(St >= (1<<28)) { // get_theta_idx uses int
+    St >>= 1;
+    cnt = std::max(cnt >> 1,int64_t(1));
+  }
+  params.theta_id = get_theta_idx(cnt,St);
+}
+
+void Static_context_model::fit_bias(const std::vector<static_ctx_stats_t> &stats){
+  static_ctx_stats_t default_stats;
+  for(int ctx = 0; ctx < CTX_BINS; ++ctx) {
+    ctx_fitted[ctx] = stats[ctx].cnt >= STATIC_CTX_MIN_CNT;
+    if(!ctx_fitted[ctx]) {
+      default_stats.add(stats[ctx]);
+    }else if(ctx != CTX_0) { // CTX_0 shouldn't have bias
+      fit_static_ctx_bias(stats[ctx],ctx_params[ctx]);
+    }
+  }
+  fit_static_ctx_bias(default_stats,default_params);
+  set_default_params();
+}
+
+void Static_context_model::fit_coder_params(const std::vector<static_ctx_stats_t> &stats){
+  static_ctx_stats_t default_stats;
+  for(int ctx = 0; ctx < CTX_BINS; ++ctx) {
+    if(!ctx_fitted[ctx]) {
+      default_stats.add(stats[ctx]);
+    }else{
+      fit_static_ctx_coder_params(stats[ctx],ctx_params[ctx]);
+    }
+  }
+  fit_static_ctx_coder_params(default_stats,default_params);
+  set_default_params();
+}
+
+static uint8_t* write_static_ctx_params(const static_ctx_params_t &params, uint8_t *data){
+  *data++ = params.bias;
+  *data++ = params.theta_id | (params.inv_sign? 0x80 : 0);
+  *data++ = params.p_id;
+  return data;
+}
+
+static const uint8_t* read_static_ctx_params(const uint8_t *data, static_ctx_params_t &params){
+  params.bias = data[0];
+  params.theta_id = data[1] & 0x7F;
+  params.inv_sign = (data[1] & 0x80)? -1 : 0;
+  params.p_id = data[2];
+  if(params.theta_id > MAX_ST_IDX || params.p_id > MAX_Nt_IDX) {
+    std::cerr<<"Error: Invalid static model parameters"<<std::endl;
+    throw 1;
+  }
+  return data + STATIC_CTX_PARAMS_SIZE;
+}
+
+size_t Static_context_model::write(uint8_t *data) const{
+  uint8_t *const bitmap = write_static_ctx_params(default_params,data);
+  uint8_t *params_data = bitmap + STATIC_CTX_BITMAP_SIZE;
+  memset(bitmap,0,STATIC_CTX_BITMAP_SIZE);
+  for(int ctx = 0; ctx < CTX_BINS; ++ctx) {
+    if(ctx_fitted[ctx]) {
+      bitmap[ctx>>3] |= 1 << (ctx&0x7);
+      params_data = write_static_ctx_params(ctx_params[ctx],params_data);
+    }
+  }
+  return params_data - data;
+}
+
+size_t Static_context_model::read(const uint8_t *data){
+  const uint8_t *const bitmap = read_static_ctx_params(data,default_params);
+  const uint8_t *params_data = bitmap + STATIC_CTX_BITMAP_SIZE;
+  for(int ctx = 0; ctx < CTX_BINS; ++ctx) {
+    ctx_fitted[ctx] = (bitmap[ctx>>3] >> (ctx&0x7)) & 0x1;
+    if(ctx_fitted[ctx]) {
+      params_data = read_static_ctx_params(params_data,ctx_params[ctx]);
+    }
+  }
+  set_default_params();
+  return params_data - data;
 }
 
 
+} // namespace CODER_PROFILE_NS
 
-#endif // CONTEXT_H
+#endif // CONTEXT_H
\ No newline at end of file
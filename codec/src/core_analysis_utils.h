@@ -27,10 +27,11 @@
 #include "context.h"
 #include "ANS_coder.h"
 
-std::array<double, CTX_BINS> ctx_code_bit_acc={0};
+namespace CODER_PROFILE_NS {
 
-long double theoretical_bits = 0;
-long double theoretical_entropy = 0;
+// analysis accumulators are per thread, as blocks can be coded concurrently
+thread_local long double theoretical_bits = 0;
+thread_local long double theoretical_entropy = 0;
 
 float kld_minimizing_rec_value(float l,float h){
   const float C = log2(1-l) - log2(1-h) + l/(1-l)*log2(l) - h/(1-h)*log2(h);
@@ -38,7 +39,7 @@ float kld_minimizing_rec_value(float l,float h){
   return pow(2,C1);
 }
 
-float get_St_rec_value(int idx, int context){
+float get_St_rec_value(int idx, int context,const Context_model &ctx_model){
   float  low_b,high_b;
   const int p = -CTX_ST_PRECISION;
 
@@ -63,8 +64,8 @@ float get_St_rec_value(int idx, int context){
 
   // verification 
   #if ITERATIVE_ST
-    assert(idx ==0 || low_b<=(ctx_St[context]/float(CTX_ST_FACTOR))/((float) ctx_cnt[context]));
-    assert((ctx_St[context]/float(CTX_ST_FACTOR))/((float) ctx_cnt[context])<=high_b+.01 || 
+    assert(idx ==0 || low_b<=(ctx_model.ctx_state[context].St/float(CTX_ST_FACTOR))/((float) ctx_model.ctx_state[context].cnt));
+    assert((ctx_model.ctx_state[context].St/float(CTX_ST_FACTOR))/((float) ctx_model.ctx_state[context].cnt)<=high_b+.01 || 
                 idx == MAX_ST_IDX);
   #endif
   assert(low_b<=St_rx);
@@ -75,11 +76,13 @@ float get_St_rec_value(int idx, int context){
 }
 
 
-void estimate_entropy(ee_symb_data symbol,Context_t context,int near  ){
+void estimate_entropy(ee_symb_data symbol,Context_t context,int near,
+                                        const Context_model &ctx_model ){
 
-  float t = (float) ctx_cnt[context.id];
-  float St  = ctx_St[context.id]/float(CTX_ST_FACTOR);
-  float Nt  =  (ctx_p_idx[context.id]*t + ctx_Nt[context.id])/float(CTX_NT_FACTOR);
+  const context_state_t &state = ctx_model.ctx_state[context.id];
+  float t = (float) state.cnt;
+  float St  = state.St/float(CTX_ST_FACTOR);
+  float Nt  =  (state.p_idx*t + state.Nt)/float(CTX_NT_FACTOR);
 
   //y entropy
   double y_beta_a = .5;
@@ -123,7 +126,8 @@ void estimate_entropy(ee_symb_data symbol,Context_t context,int near  ){
 }
 
 
-void estimate_code_length(ee_symb_data symbol,Context_t context  ){
+void estimate_code_length(ee_symb_data symbol,Context_t context,
+                                        const Context_model &ctx_model ){
 
   // get reconstruction value (not done in coder, id select ANS table)
   // The reconstructions does not need to be in the center of the interval
@@ -143,7 +147,7 @@ void estimate_code_length(ee_symb_data symbol,Context_t context  ){
 
   // z prob
   #if CTX_ST_FINER_QUANT
-    float St_av = get_St_rec_value(symbol.theta_id,context.id);
+    float St_av = get_St_rec_value(symbol.theta_id,context.id,ctx_model);
   #else
     const float simp_ratio = 1/sqrt(2);
     float St_av = (1<<symbol.theta_id)*simp_ratio/CTX_ST_FACTOR;
@@ -164,5 +168,14 @@ void estimate_code_length(ee_symb_data symbol,Context_t context  ){
 
 }
 
+// The static model doesn't keep the statistics used by the estimations
+void estimate_entropy(ee_symb_data symbol,Context_t context,int near,
+                                        const Static_context_model &ctx_model ){}
+
+void estimate_code_length(ee_symb_data symbol,Context_t context,
+                                        const Static_context_model &ctx_model ){}
+
+
+} // namespace CODER_PROFILE_NS
 
 #endif // CORE_ANALYSIS_UTILS_H
@@ -33,7 +33,7 @@
   }
 
 
-  int get_num_of_symbs(int rows, int cols, char chroma_mode){
+  inline int get_num_of_symbs(int rows, int cols, char chroma_mode){
     int num_symb;
     switch(chroma_mode){
       case CHROMA_MODE_YUV422:
@@ -119,7 +119,7 @@
 *##################   quality_measures  ########################
 */
 
-  double mse(const cv::Mat img0,const cv::Mat img1){
+  inline double mse(const cv::Mat img0,const cv::Mat img1){
     cv::Mat tmp(img0.rows,img0.cols,CV_32F);
     //cv::subtract(img0, img1, tmp);
     cv::absdiff(img0, img1, tmp);
@@ -135,7 +135,7 @@
     return mse;
   }
 
-  double psnr(const cv::Mat img0,const cv::Mat img1,int max_value=255){
+  inline double psnr(const cv::Mat img0,const cv::Mat img1,int max_value=255){
     double imgs_mse=mse(img0,img1);
 
     double psnr=10*std::log10(pow(max_value,2)/imgs_mse);
@@ -26,8 +26,10 @@
 #include <string>
 #include <algorithm>
 #include <cstdlib>
+#include <cstring>
 
 #include "codec.h"
+#include "batch.h"
 
 #include <sys/time.h>
 
@@ -40,15 +42,110 @@ int main(int arg, char** argv ){
   int encode_prediction =ENCODER_PRED_LOCO; //default (deprecated)
   int NEAR =0; //default lossless
   int ibpp =8;
+  int threads = 1;
+  bool add_block_index = true;
+  bool pipelined = false;
+  int num_ANS_states = 1;
+  bool strip_mode = false;
+  bool two_pass = false;
+  int ee_buffer_size = EE_BUFFER_SIZE;
+  bool static_model = false;
+  int coder_profile = CODER_PROFILE_DEFAULT;
+  int workers = 1;
+  std::string summary_path;
+  bool decode_roi = false;
+  int roi_x=0, roi_y=0, roi_w=0, roi_h=0;
+
+  // named options can be placed anywhere. They are removed from argv so the
+  // positional args keep their index
+  {
+    int num_pos_args = 0;
+    for(int i = 0; i < arg; ++i) {
+      if(strcmp(argv[i],"--threads") == 0 && i+1 < arg) {
+        threads = atoi(argv[++i]);
+      }else if(strcmp(argv[i],"--no-index") == 0) {
+        add_block_index = false;
+      }else if(strcmp(argv[i],"--pipelined") == 0) {
+        pipelined = true;
+      }else if(strcmp(argv[i],"--ans-states") == 0 && i+1 < arg) {
+        num_ANS_states = atoi(argv[++i]);
+      }else if(strcmp(argv[i],"--workers") == 0 && i+1 < arg) {
+        workers = atoi(argv[++i]);
+      }else if(strcmp(argv[i],"--summary") == 0 && i+1 < arg) {
+        summary_path = argv[++i];
+      }else if(strcmp(argv[i],"--strips") == 0) {
+        strip_mode = true;
+      }else if(strcmp(argv[i],"--two-pass") == 0) {
+        two_pass = true;
+      }else if(strcmp(argv[i],"--chunk-size") == 0 && i+1 < arg) {
+        ee_buffer_size = atoi(argv[++i]);
+      }else if(strcmp(argv[i],"--static-model") == 0) {
+        static_model = true;
+      }else if(strcmp(argv[i],"--profile") == 0 && i+1 < arg) {
+        coder_profile = get_coder_profile_id(argv[++i]);
+        if(coder_profile < 0) {
+          std::cerr<<" Error: Unknown coder profile: "<<argv[i]<<std::endl;
+          return 1;
+        }
+      }else if(strcmp(argv[i],"--region") == 0 && i+4 < arg) {
+        decode_roi = true;
+        roi_x = atoi(argv[++i]);
+        roi_y = atoi(argv[++i]);
+        roi_w = atoi(argv[++i]);
+        roi_h = atoi(argv[++i]);
+      }else{
+        argv[num_pos_args++] = argv[i];
+      }
+    }
+    arg = num_pos_args;
+  }
+
   if( arg < 3) {
-    printf("Args: encode(0)/decode(1) args \n");
+    printf("Args: encode(0)/decode(1)/batch encode(2)/batch decode(3) args [--threads N] [--no-index] [--pipelined] [--ans-states K] [--strips] [--two-pass] [--chunk-size N] [--static-model] [--profile fast|default|dense]\n");
     printf("Encode args: 0 src_img_path out_compressed_img_path [NEAR] [encode_mode] [blk_height]  [blk_width]   \n");
-    printf("Decode args: 1 compressed_img_path path_to_out_image  \n");
+    printf("Decode args: 1 compressed_img_path path_to_out_image [--region x y w h] \n");
+    printf("Batch encode args: 2 src_dir_or_file_list out_dir [NEAR_list (ex: 0,1,3)] [blk_height] [blk_width] [--workers N] [--summary path.csv|path.json] \n");
+    printf("Batch decode args: 3 compressed_dir_or_file_list out_dir [--workers N] [--summary path.csv|path.json] \n");
     return 1;
   }
 
+  int mode = atoi(argv[1]);
 
-  bool decode= atoi(argv[1]);
+  if(mode == 2 || mode == 3) {
+    if(arg < 4) {
+      std::cerr<<" Error: Batch mode requires an input and an output directory"<<std::endl;
+      return 1;
+    }
+    batch_config_t batch_config;
+    batch_config.near_list = {0};
+    if(mode == 2 && arg > 4 && !parse_near_list(argv[4],batch_config.near_list)) {
+      std::cerr<<" Error: Invalid NEAR list: "<<argv[4]<<std::endl;
+      return 1;
+    }
+    if(mode == 2 && arg > 5) {
+      batch_config.blk_height = atoi(argv[5]);
+    }
+    if(mode == 2 && arg > 6) {
+      batch_config.blk_width = atoi(argv[6]);
+    }
+    batch_config.workers = workers;
+    batch_config.threads = threads;
+    batch_config.add_block_index = add_block_index;
+    batch_config.pipelined = pipelined;
+    batch_config.num_ANS_states = num_ANS_states;
+    batch_config.strip_mode = strip_mode;
+    batch_config.two_pass = two_pass;
+    batch_config.ee_buffer_size = ee_buffer_size;
+    batch_config.static_model = static_model;
+    batch_config.coder_profile = coder_profile;
+    batch_config.summary_path = summary_path;
+
+    int errors = mode == 2? batch_encode(argv[2],argv[3],batch_config) :
+                            batch_decode(argv[2],argv[3],batch_config);
+    return errors == 0? 0 : 1;
+  }
+
+  bool decode= mode;
 
   if( ! decode) {
     char * img_path= argv[2];
@@ -88,11 +185,36 @@ int main(int arg, char** argv ){
 
     std::cout<<" Encoder configuration ";
     std::cout<<"| NEAR: "<<NEAR; 
+    if(strip_mode) {
+      blk_height = img_orig.rows;
+      std::cout<<"| strip mode ";
+    }
     std::cout<<"| blk_height: "<<blk_height; 
     std::cout<<"| blk_width: "<<blk_width; 
     if(encode_mode != ENCODER_MODE_ENCODE) {
       std::cout<<"| encode_mode: "<<encode_mode;
     }
+    if(threads > 1) {
+      std::cout<<"| threads: "<<threads;
+    }
+    if(pipelined) {
+      std::cout<<"| pipelined ";
+    }
+    if(num_ANS_states > 1) {
+      std::cout<<"| ANS states: "<<num_ANS_states;
+    }
+    if(two_pass) {
+      std::cout<<"| two-pass ";
+    }
+    if(ee_buffer_size != EE_BUFFER_SIZE) {
+      std::cout<<"| chunk size: "<<ee_buffer_size;
+    }
+    if(static_model) {
+      std::cout<<"| static model ";
+    }
+    if(coder_profile != CODER_PROFILE_DEFAULT) {
+      std::cout<<"| profile: "<<get_coder_profile_api(coder_profile)->name;
+    }
     std::cout<< std::endl;
  
     if(NEAR < 0) {
@@ -105,23 +227,32 @@ int main(int arg, char** argv ){
     int compress_img_size;
     clock_gettime(CLOCK_MONOTONIC, &ini);
     compress_img_size=encoder(img_orig,out_file,blk_width,blk_height,
-                    chroma_mode,encode_prediction,NEAR,encode_mode,ibpp);
+                    chroma_mode,encode_prediction,NEAR,encode_mode,ibpp,threads,
+                    add_block_index,pipelined,num_ANS_states,strip_mode,two_pass,
+                    ee_buffer_size,static_model,coder_profile);
     clock_gettime(CLOCK_MONOTONIC, &fin);
+    if (compress_img_size<0){
+      std::cerr<<"there's been an error in trying to encode the image"<<std::endl;
+      return -1;
+    }
 
     float enc_time = ((fin.tv_sec+fin.tv_nsec* 1E-9)-(ini.tv_sec+ini.tv_nsec* 1E-9));
     float enc_bw = img_orig.cols*img_orig.rows/(1024*1024*enc_time);
     printf("Encoder time: %.3f | BW: %.3f MP/s |", enc_time,enc_bw );
     printf(" Achieved bpp: %.3f \n",float(compress_img_size*8)/(img_orig.cols*img_orig.rows));
-    if (compress_img_size<0){
-      std::cerr<<"there's been an error in trying to encode the image"<<std::endl;
-      return -1;
-    }
 
   }else{
     char * compressed_img= argv[2];
     char * out_path= argv[3];
     std::cout<<"Compressed image:"<<compressed_img<<std::endl;
     std::cout<<"Out decoded image path: "<<out_path<<std::endl;
+    if(threads > 1) {
+      std::cout<<"Decoder threads: "<<threads<<std::endl;
+    }
+    if(decode_roi) {
+      std::cout<<"Decoded region: x: "<<roi_x<<" | y: "<<roi_y
+                <<" | w: "<<roi_w<<" | h: "<<roi_h<<std::endl;
+    }
 
     cv::Mat decode_img;
     // struct timeval fin,ini;
@@ -129,7 +260,13 @@ int main(int arg, char** argv ){
     bool scale_depth = true;
     // gettimeofday(&ini,NULL);
     clock_gettime(CLOCK_MONOTONIC, &ini);
-    int deco_status = decoder(compressed_img,decode_img,scale_depth);
+    int deco_status;
+    if(decode_roi) {
+      deco_status = decode_region(compressed_img,decode_img,roi_x,roi_y,roi_w,roi_h,
+                                  scale_depth,threads);
+    }else{
+      deco_status = decoder(compressed_img,decode_img,scale_depth,threads);
+    }
     clock_gettime(CLOCK_MONOTONIC, &fin);
     // gettimeofday(&fin,NULL);
     float dec_time = ((fin.tv_sec+fin.tv_nsec* 1E-9)-(ini.tv_sec+ini.tv_nsec* 1E-9));
@@ -0,0 +1,138 @@
+/*
+  Copyright 2021 Tobías Alonso, Autonomous University of Madrid
+
+  This file is part of LOCO-ANS.
+
+  LOCO-ANS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  LOCO-ANS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with LOCO-ANS.  If not, see <https://www.gnu.org/licenses/>.
+
+
+ */
+
+/* Writes the tANS tables of a coder profile (built with the table generator,
+ * see ANS_table_gen.h) to out_dir, in the format of the coder_config_gen
+ * notebook: the 4 table files of codec/src/ANS_tables, the z cardinalities,
+ * and tANS_tables.h, which the profile includes (ANS_TABLES_FILE).
+ * The profile parameters are given at compile time (see Makefile).
+ * Usage: ans_table_gen out_dir
+ */
+
+#include "ANS_coder.h"
+
+#include <cstdio>
+#include <string>
+
+using namespace CODER_PROFILE_NS;
+
+static FILE* open_out_file(const std::string &out_dir, const char* name){
+  const std::string path = out_dir + "/" + name;
+  FILE* file = fopen(path.c_str(),"w");
+  if(file == nullptr) {
+    std::cerr<<"Error: Unable to open "<<path<<std::endl;
+    exit(1);
+  }
+  return file;
+}
+
+template<int NUM_MODES, int MAX_SYMBOLS>
+static void write_enc_table(FILE* file,const tANS_table_t table[NUM_MODES][NUM_ANS_STATES][MAX_SYMBOLS],
+                                                          const double* params){
+  for(int mode = 0; mode < NUM_MODES; ++mode) {
+    fprintf(file,"%s{ // mode: %d | param: %f \n",mode == 0? "" : "}, ",mode,params[mode]);
+    for(int state = 0; state < NUM_ANS_STATES; ++state) {
+      fprintf(file,"{");
+      for(int symbol = 0; symbol < MAX_SYMBOLS; ++symbol) {
+        fprintf(file,"%s{%3d, %d}",symbol == 0? "" : ", ",
+              int(table[mode][state][symbol].next_state),int(table[mode][state][symbol].bits));
+      }
+      fprintf(file,"}%s// state: %d\n",state == NUM_ANS_STATES-1? "  " : ", ",state);
+    }
+  }
+  fprintf(file,"}\n");
+}
+
+template<int NUM_MODES>
+static void write_dec_table(FILE* file,const tANS_state_t table[NUM_MODES][NUM_ANS_STATES][2],
+                                                          const double* params){
+  for(int mode = 0; mode < NUM_MODES; ++mode) {
+    fprintf(file,"%s{ // mode_id: %3d | parameter: %f \n",mode == 0? "" : "}, ",
+                                                                  mode,params[mode]);
+    for(int state = 0; state < NUM_ANS_STATES; ++state) {
+      fprintf(file,"{%3d, %3d}%s// state: %d \n",int(table[mode][state][ANS_SYMBOL]),
+                  int(table[mode][state][ANS_PREV_STATE]),
+                  state == NUM_ANS_STATES-1? "  " : ", ",state);
+    }
+  }
+  fprintf(file,"} \n");
+}
+
+int main(int argc, char** argv){
+  if(argc != 2) {
+    std::cerr<<"Usage: "<<argv[0]<<" out_dir"<<std::endl;
+    return 1;
+  }
+  const std::string out_dir = argv[1];
+
+  tANS_ROM_tables_t rom;
+  build_tANS_ROM_tables(rom);
+
+  double theta_params[NUM_ANS_THETA_MODES], p_params[NUM_ANS_P_MODES];
+  for(int theta_id = 0; theta_id < NUM_ANS_THETA_MODES; ++theta_id) {
+    theta_params[theta_id] = get_St_mode_param(theta_id,CTX_ST_FINER_QUANT);
+  }
+  for(int p_id = 0; p_id < NUM_ANS_P_MODES; ++p_id) {
+    p_params[p_id] = get_p_mode_param(p_id);
+  }
+
+  FILE* file = open_out_file(out_dir,"tANS_z_encoder_table.dat");
+  write_enc_table<NUM_ANS_THETA_MODES,ANS_MAX_SRC_CARDINALITY>(file,rom.z_enc,theta_params);
+  fclose(file);
+  file = open_out_file(out_dir,"tANS_y_encoder_table.dat");
+  write_enc_table<NUM_ANS_P_MODES,2>(file,rom.y_enc,p_params);
+  fclose(file);
+  file = open_out_file(out_dir,"tANS_z_decoder_table.dat");
+  write_dec_table<NUM_ANS_THETA_MODES>(file,rom.z_dec,theta_params);
+  fclose(file);
+  file = open_out_file(out_dir,"tANS_y_decoder_table.dat");
+  write_dec_table<NUM_ANS_P_MODES>(file,rom.y_dec,p_params);
+  fclose(file);
+
+  file = open_out_file(out_dir,"tANS_z_cardinality_table.dat");
+  for(int theta_id = 0; theta_id < NUM_ANS_THETA_MODES; ++theta_id) {
+    fprintf(file,"%d%s",int(rom.z_cardinality[theta_id]),
+                              theta_id == NUM_ANS_THETA_MODES-1? "\n" : ",");
+  }
+  fclose(file);
+
+  file = open_out_file(out_dir,"tANS_tables.h");
+  fprintf(file,
+    "// tANS tables of the %s coder profile, written by tools/ans_table_gen\n"
+    "// (included by ANS_coder.h, see ANS_TABLES_FILE)\n"
+    "static const tANS_table_t tANS_z_encode_table[NUM_ANS_THETA_MODES][NUM_ANS_STATES][ANS_MAX_SRC_CARDINALITY]{\n"
+    "  #include \"tANS_z_encoder_table.dat\"\n"
+    "};\n"
+    "static const tANS_table_t tANS_y_encode_table[NUM_ANS_P_MODES][NUM_ANS_STATES][2]{\n"
+    "  #include \"tANS_y_encoder_table.dat\"\n"
+    "};\n"
+    "static const tANS_state_t tANS_z_decode_table[NUM_ANS_THETA_MODES][NUM_ANS_STATES][2]{\n"
+    "  #include \"tANS_z_decoder_table.dat\"\n"
+    "};\n"
+    "static const tANS_state_t tANS_y_decode_table[NUM_ANS_P_MODES][NUM_ANS_STATES][2]{\n"
+    "  #include \"tANS_y_decoder_table.dat\"\n"
+    "};\n"
+    "static const uint8_t tANS_z_cardinality[NUM_ANS_THETA_MODES]{\n"
+    "  #include \"tANS_z_cardinality_table.dat\"\n"
+    "};\n",CODER_PROFILE_NAME);
+  fclose(file);
+  return 0;
+}
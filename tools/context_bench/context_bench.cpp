@@ -0,0 +1,125 @@
+/*
+  Copyright 2021 Tobías Alonso, Autonomous University of Madrid
+
+  This file is part of LOCO-ANS.
+
+  LOCO-ANS is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  LOCO-ANS is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with LOCO-ANS.  If not, see <https://www.gnu.org/licenses/>.
+
+
+ */
+
+/* Context model microbenchmark:
+ * Times the per-pixel context model work of the scanners (parameter lookups
+ * and update_context) on a synthetic sequence of samples. Gradients and
+ * errors follow Laplacian distributions, so the context usage is similar to
+ * the one of a natural image.
+ * It also times the context model setup done for each block (tile), and 
+ * reports its share of the context model time of a tile of tile_pixels.
+ */
+
+#include "context.h"
+
+// context model of the default coder profile (see Coder profiles in
+// coder_config.h)
+using namespace CODER_PROFILE_NS;
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+struct sample_t {
+  Context_t context;
+  int error;
+};
+
+static int laplacian(std::mt19937 &gen, double scale){
+  std::exponential_distribution<double> dist(1/scale);
+  const int magnitude = dist(gen) + 0.5;
+  return gen() & 0x1? magnitude : -magnitude;
+}
+
+static int clamp_gradient(int g){
+  return std::min(std::max(g,-255),255);
+}
+
+int main(int argc, char const *argv[])
+{
+  const int num_of_samples = argc > 1? atoi(argv[1]) : 1<<20;
+  const int reps = argc > 2? atoi(argv[2]) : 20;
+  const int near = argc > 3? atoi(argv[3]) : 0;
+  const int tile_pixels = argc > 4? atoi(argv[4]) : 8*128;
+  if(num_of_samples <= 0 || reps <= 0 || near < 0 || tile_pixels <= 0) {
+    printf("args: [num_of_samples] [reps] [NEAR] [tile_pixels]\n");
+    return 1;
+  }
+
+  const int MAXVAL = 255;
+  const int delta = 2*near +1;
+  const int alpha = near ==0? MAXVAL + 1 : (MAXVAL + 2 * near) / delta + 1;
+
+  std::mt19937 gen(1234);
+  std::vector<sample_t> samples(num_of_samples);
+  for(auto & sample: samples) {
+    sample.context = map_gradients_to_int(clamp_gradient(laplacian(gen,6)),
+                        clamp_gradient(laplacian(gen,6)),clamp_gradient(laplacian(gen,6)),
+                        clamp_gradient(laplacian(gen,3)));
+    sample.error = std::min(std::max(laplacian(gen,4),-alpha/2),alpha/2-1);
+  }
+
+  double best_time = 1e9;
+  long checksum = 0;
+  for(int rep = 0; rep < reps; ++rep) {
+    Context_model ctx_model(near,alpha);
+    const auto start = std::chrono::steady_clock::now();
+    for(const auto & sample: samples) {
+      const Context_t context = sample.context;
+      const int bias = ctx_model.get_context_bias(context);
+      const int theta_id = ctx_model.get_context_theta_idx(context);
+      const int p_id = ctx_model.get_context_p_idx(context);
+      const int inv_sign = ctx_model.get_context_inv_sign(context);
+
+      const int error = mult_by_sign(sample.error,inv_sign);
+      const int y = error < 0? 1:0;
+      const int z = abs(error)-y;
+      checksum += bias + theta_id + p_id;
+      ctx_model.update_context(context,mult_by_sign(delta*error,inv_sign),z,y);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    best_time = std::min(best_time,std::chrono::duration<double>(end-start).count());
+  }
+
+  const double sample_time = best_time/num_of_samples;
+
+  // setup: a context model per tile
+  const int num_of_tiles = std::max(num_of_samples/tile_pixels,1);
+  best_time = 1e9;
+  for(int rep = 0; rep < reps; ++rep) {
+    const auto start = std::chrono::steady_clock::now();
+    for(int tile = 0; tile < num_of_tiles; ++tile) {
+      Context_model ctx_model(near,alpha);
+      checksum += ctx_model.get_context_theta_idx(samples[tile].context);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    best_time = std::min(best_time,std::chrono::duration<double>(end-start).count());
+  }
+  const double setup_time = best_time/num_of_tiles;
+
+  printf("Context model: %.3f ns/sample (best of %d reps, %d samples)\n",
+                    sample_time*1e9, reps, num_of_samples);
+  printf("Setup: %.1f ns/tile | %.2f%% of a %d pixel tile | checksum: %ld\n",
+        setup_time*1e9, 100*setup_time/(setup_time + tile_pixels*sample_time),
+        tile_pixels, checksum);
+  return 0;
+}